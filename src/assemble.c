@@ -0,0 +1,1812 @@
+#include "kiwicc.h"
+#include <elf.h>
+
+/*********************************************
+* ...assembler...
+*********************************************/
+
+// A built-in assembler for the subset of the RV64IMFD assembly that
+// codegen() emits. It takes the assembly text line by line (see println()
+// in main.c) and writes an ELF64 relocatable object file, so that we
+// don't need to write a temporary file and run an external assembler.
+//
+// Instructions are always emitted uncompressed and we don't do linker
+// relaxation. Branches and jumps to labels in the same section are
+// resolved here; the other symbol references are left as relocations.
+
+typedef struct Buffer Buffer;
+typedef struct Symbol Symbol;
+typedef struct Section Section;
+typedef struct Fixup Fixup;
+typedef struct LineRow LineRow;
+
+// Growable byte buffer
+struct Buffer
+{
+  char *data;
+  int len;
+  int cap;
+};
+
+struct Section
+{
+  char *name;
+  int type;    // SHT_PROGBITS or SHT_NOBITS
+  int flags;   // SHF_*
+  int align;   // Alignment in bytes
+  Buffer buf;  // Contents. Only `buf.len` is used for SHT_NOBITS.
+
+  // References to symbols in the order of their offsets
+  Fixup **fixups;
+  int nfixups;
+  int fixup_cap;
+
+  Symbol *sym; // Section symbol
+  int shndx;   // Section header index
+};
+
+struct Symbol
+{
+  char *name;
+  Section *sec;   // NULL if undefined
+  long offset;    // Offset in `sec`
+  bool is_global;
+  bool is_section;
+  bool keep;      // Keep this .L label in the symbol table
+  bool is_tls;    // Thread-local variable
+  int index;      // Symbol table index
+};
+
+// A reference to a symbol which is either resolved by the assembler
+// or written out as a relocation.
+struct Fixup
+{
+  int offset;     // Offset in the section
+  int type;       // R_RISCV_*
+  Symbol *sym;
+  long addend;
+  bool is_long;   // R_RISCV_BRANCH relaxed to a branch and a jump
+  bool resolved;  // Patched by the assembler
+};
+
+// A row of the line number table
+struct LineRow
+{
+  int offset;
+  int file_no;
+  int line_no;
+};
+
+static bool initialized;
+static char *cur_line; // Used for error messages
+
+static HashMap symbol_map;
+static Symbol **symbols;
+static int nsymbols;
+static int symbol_cap;
+
+static Section **sections;
+static int nsections;
+static int section_cap;
+static Section *cur_sec;
+static Section *text_sec;
+
+static int pcrel_seq;
+
+// File names given by .file, indexed by file number
+static char **files;
+static int nfiles;
+static int file_cap;
+
+// Line number table built from .loc
+static LineRow *rows;
+static int nrows;
+static int row_cap;
+static int loc_file_no;
+static int loc_line_no;
+static bool has_loc;
+
+// Make sure that `buf` has room for `n` elements of `size` bytes.
+static void *reserve(void *buf, int *cap, int n, int size)
+{
+  if (n <= *cap)
+    return buf;
+  int cap2 = *cap ? *cap : 16;
+  while (cap2 < n)
+    cap2 *= 2;
+  *cap = cap2;
+  return realloc(buf, (long)cap2 * size);
+}
+
+/*** Buffer ***/
+
+static void buf_push(Buffer *buf, void *p, int n)
+{
+  buf->data = reserve(buf->data, &buf->cap, buf->len + n, 1);
+  memcpy(buf->data + buf->len, p, n);
+  buf->len += n;
+}
+
+static void buf_u8(Buffer *buf, int val)
+{
+  char c = val;
+  buf_push(buf, &c, 1);
+}
+
+static void buf_zero(Buffer *buf, int n)
+{
+  for (int i = 0; i < n; i++)
+    buf_u8(buf, 0);
+}
+
+static void buf_uint(Buffer *buf, unsigned long val, int size)
+{
+  // Little endian
+  for (int i = 0; i < size; i++)
+    buf_u8(buf, (val >> (i * 8)) & 0xff);
+}
+
+static void buf_uleb(Buffer *buf, unsigned long val)
+{
+  do
+  {
+    int c = val & 0x7f;
+    val = val >> 7;
+    buf_u8(buf, val ? (c | 0x80) : c);
+  } while (val);
+}
+
+static void buf_sleb(Buffer *buf, long val)
+{
+  for (;;)
+  {
+    int c = val & 0x7f;
+    val = val >> 7;
+    if ((val == 0 && !(c & 0x40)) || (val == -1 && (c & 0x40)))
+    {
+      buf_u8(buf, c);
+      return;
+    }
+    buf_u8(buf, c | 0x80);
+  }
+}
+
+static void buf_str(Buffer *buf, char *s)
+{
+  buf_push(buf, s, strlen(s) + 1);
+}
+
+static void buf_align(Buffer *buf, int align)
+{
+  buf_zero(buf, align_to(buf->len, align) - buf->len);
+}
+
+static void write_u32(char *p, unsigned int val)
+{
+  for (int i = 0; i < 4; i++)
+    p[i] = (val >> (i * 8)) & 0xff;
+}
+
+static unsigned int read_u32(char *p)
+{
+  unsigned char *q = (unsigned char *)p;
+  return q[0] | (q[1] << 8) | (q[2] << 16) | ((unsigned)q[3] << 24);
+}
+
+/*** Symbols and sections ***/
+
+static bool is_local_label(char *name)
+{
+  return !strncmp(name, ".L", 2);
+}
+
+static Symbol *new_symbol(char *name)
+{
+  Symbol *sym = calloc(1, sizeof(Symbol));
+  sym->name = name;
+  return sym;
+}
+
+static Symbol *get_symbol(char *name)
+{
+  Symbol *sym = hashmap_get(&symbol_map, name);
+  if (sym)
+    return sym;
+
+  sym = new_symbol(strdup(name));
+  hashmap_put(&symbol_map, sym->name, sym);
+  symbols = reserve(symbols, &symbol_cap, nsymbols + 1, sizeof(Symbol *));
+  symbols[nsymbols++] = sym;
+  return sym;
+}
+
+static Section *get_section(char *name)
+{
+  for (int i = 0; i < nsections; i++)
+    if (!strcmp(sections[i]->name, name))
+      return sections[i];
+
+  Section *sec = calloc(1, sizeof(Section));
+  sec->name = strdup(name);
+  sec->type = SHT_PROGBITS;
+  sec->align = 1;
+
+  if (!strcmp(name, ".text"))
+  {
+    sec->flags = SHF_ALLOC | SHF_EXECINSTR;
+    sec->align = 4;
+  }
+  else if (!strcmp(name, ".data"))
+    sec->flags = SHF_ALLOC | SHF_WRITE;
+  else if (!strcmp(name, ".rodata"))
+    sec->flags = SHF_ALLOC;
+  else if (!strcmp(name, ".bss"))
+  {
+    sec->type = SHT_NOBITS;
+    sec->flags = SHF_ALLOC | SHF_WRITE;
+  }
+  else if (!strcmp(name, ".tdata"))
+    sec->flags = SHF_ALLOC | SHF_WRITE | SHF_TLS;
+  else if (!strcmp(name, ".tbss"))
+  {
+    sec->type = SHT_NOBITS;
+    sec->flags = SHF_ALLOC | SHF_WRITE | SHF_TLS;
+  }
+  else if (strncmp(name, ".debug_", 7))
+    error("assembler: unknown section: %s", name);
+
+  sec->sym = new_symbol(sec->name);
+  sec->sym->sec = sec;
+  sec->sym->is_section = true;
+
+  sections = reserve(sections, &section_cap, nsections + 1, sizeof(Section *));
+  sections[nsections++] = sec;
+  return sec;
+}
+
+static void init()
+{
+  initialized = true;
+  // Create the standard sections in the same order as GNU as does.
+  text_sec = get_section(".text");
+  get_section(".data");
+  get_section(".bss");
+  cur_sec = text_sec;
+}
+
+static void add_fixup(Section *sec, int offset, int type, Symbol *sym, long addend)
+{
+  Fixup *fx = calloc(1, sizeof(Fixup));
+  fx->offset = offset;
+  fx->type = type;
+  fx->sym = sym;
+  fx->addend = addend;
+  sec->fixups = reserve(sec->fixups, &sec->fixup_cap, sec->nfixups + 1, sizeof(Fixup *));
+  sec->fixups[sec->nfixups++] = fx;
+}
+
+static void define_label(char *name)
+{
+  Symbol *sym = get_symbol(name);
+  if (sym->sec)
+    error("assembler: symbol already defined: %s", name);
+  sym->sec = cur_sec;
+  sym->offset = cur_sec->buf.len;
+  if (cur_sec->flags & SHF_TLS)
+    sym->is_tls = true;
+}
+
+static void emit_zero(int n)
+{
+  if (cur_sec->type == SHT_NOBITS)
+  {
+    cur_sec->buf.len += n;
+    return;
+  }
+  buf_zero(&cur_sec->buf, n);
+}
+
+static void emit_insn(unsigned int insn)
+{
+  if (cur_sec->type == SHT_NOBITS)
+    error("assembler: %s: instruction in a nobits section", cur_line);
+
+  // Attach the last .loc to this instruction.
+  if (has_loc && cur_sec == text_sec)
+  {
+    rows = reserve(rows, &row_cap, nrows + 1, sizeof(LineRow));
+    LineRow *row = &rows[nrows++];
+    row->offset = cur_sec->buf.len;
+    row->file_no = loc_file_no;
+    row->line_no = loc_line_no;
+    has_loc = false;
+  }
+  buf_uint(&cur_sec->buf, insn, 4);
+}
+
+/*** Operand parsing ***/
+
+static char *xreg_names[] = {
+  "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+  "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+  "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+  "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+};
+
+static char *freg_names[] = {
+  "ft0", "ft1", "ft2", "ft3", "ft4", "ft5", "ft6", "ft7",
+  "fs0", "fs1", "fa0", "fa1", "fa2", "fa3", "fa4", "fa5",
+  "fa6", "fa7", "fs2", "fs3", "fs4", "fs5", "fs6", "fs7",
+  "fs8", "fs9", "fs10", "fs11", "ft8", "ft9", "ft10", "ft11",
+};
+
+static int reg_number(char *s, char **names, char prefix)
+{
+  for (int i = 0; i < 32; i++)
+    if (!strcmp(s, names[i]))
+      return i;
+
+  // x0 ~ x31 or f0 ~ f31
+  if (*s == prefix && isdigit(s[1]))
+  {
+    char *end;
+    long n = strtol(s + 1, &end, 10);
+    if (!*end && n < 32)
+      return n;
+  }
+  return -1;
+}
+
+static int xreg(char *s)
+{
+  int n = reg_number(s, xreg_names, 'x');
+  if (n == -1 && !strcmp(s, "fp"))
+    n = 8;
+  if (n == -1)
+    error("assembler: %s: invalid register: %s", cur_line, s);
+  return n;
+}
+
+static int freg(char *s)
+{
+  int n = reg_number(s, freg_names, 'f');
+  if (n == -1)
+    error("assembler: %s: invalid floating-point register: %s", cur_line, s);
+  return n;
+}
+
+static long imm(char *s)
+{
+  char *end;
+  errno = 0;
+  long val = strtol(s, &end, 0);
+  if (end == s || *end)
+    error("assembler: %s: invalid immediate: %s", cur_line, s);
+  return val;
+}
+
+static long imm_range(char *s, long lo, long hi)
+{
+  long val = imm(s);
+  if (val < lo || hi < val)
+    error("assembler: %s: immediate out of range: %s", cur_line, s);
+  return val;
+}
+
+static bool is_ident_char(char c)
+{
+  return isalnum(c) || c == '_' || c == '.' || c == '$';
+}
+
+// Parse "sym", "sym+N" or "sym-N".
+static Symbol *symbol_operand(char *s, long *addend)
+{
+  char *p = s;
+  while (is_ident_char(*p))
+    p++;
+  if (p == s || isdigit(*s))
+    error("assembler: %s: invalid symbol: %s", cur_line, s);
+
+  *addend = 0;
+  if (*p)
+  {
+    if (*p != '+' && *p != '-')
+      error("assembler: %s: invalid symbol: %s", cur_line, s);
+    *addend = imm(p);
+  }
+  char *name = strndup(s, p - s);
+  Symbol *sym = get_symbol(name);
+  free(name);
+  return sym;
+}
+
+// If `s` is "%fn(sym)", add a relocation of `type` to sym and
+// return true. TLS relocations must refer to the symbol itself
+// rather than to its section, so a .L label is kept.
+static bool reloc_operand(char *s, char *fn, int type)
+{
+  int len = strlen(fn);
+  if (s[0] != '%' || strncmp(s + 1, fn, len) || s[len + 1] != '(' ||
+      s[strlen(s) - 1] != ')')
+    return false;
+
+  char *arg = strndup(s + len + 2, strlen(s) - len - 3);
+  long addend;
+  Symbol *sym = symbol_operand(arg, &addend);
+  free(arg);
+  sym->is_tls = true;
+  sym->keep = true;
+  add_fixup(cur_sec, cur_sec->buf.len, type, sym, addend);
+  return true;
+}
+
+// Parse "imm(reg)" or "(reg)" and return the register number.
+static int mem_operand(char *s, long *offset)
+{
+  char *lparen = strchr(s, '(');
+  int len = strlen(s);
+  if (!lparen || s[len - 1] != ')')
+    error("assembler: %s: invalid memory operand: %s", cur_line, s);
+
+  *offset = 0;
+  if (lparen != s)
+  {
+    *lparen = '\0';
+    *offset = imm_range(s, -2048, 2047);
+  }
+  s[len - 1] = '\0';
+  return xreg(lparen + 1);
+}
+
+static int rounding_mode(char *s)
+{
+  static char *names[] = {"rne", "rtz", "rdn", "rup", "rmm"};
+  for (int i = 0; i < sizeof(names) / sizeof(*names); i++)
+    if (!strcmp(s, names[i]))
+      return i;
+  if (!strcmp(s, "dyn"))
+    return 7;
+  error("assembler: %s: invalid rounding mode: %s", cur_line, s);
+}
+
+/*** Instruction encoding ***/
+
+static unsigned int enc_r(unsigned int match, int rd, int rs1, int rs2)
+{
+  return match | (rd << 7) | (rs1 << 15) | (rs2 << 20);
+}
+
+static unsigned int enc_i(unsigned int match, int rd, int rs1, long imm)
+{
+  return match | (rd << 7) | (rs1 << 15) | ((imm & 0xfff) << 20);
+}
+
+static unsigned int enc_s(unsigned int match, int rs1, int rs2, long imm)
+{
+  return match | ((imm & 0x1f) << 7) | (rs1 << 15) | (rs2 << 20) |
+         (((imm >> 5) & 0x7f) << 25);
+}
+
+static unsigned int enc_b(unsigned int match, int rs1, int rs2, long imm)
+{
+  return match | (((imm >> 11) & 1) << 7) | (((imm >> 1) & 0xf) << 8) |
+         (rs1 << 15) | (rs2 << 20) | (((imm >> 5) & 0x3f) << 25) |
+         (((imm >> 12) & 1) << 31);
+}
+
+static unsigned int enc_u(unsigned int match, int rd, long imm)
+{
+  return match | (rd << 7) | ((imm & 0xfffff) << 12);
+}
+
+static unsigned int enc_j(unsigned int match, int rd, long imm)
+{
+  return match | (rd << 7) | (((imm >> 12) & 0xff) << 12) |
+         (((imm >> 11) & 1) << 20) | (((imm >> 1) & 0x3ff) << 21) |
+         (((imm >> 20) & 1) << 31);
+}
+
+#define OP_ADDI 0x00000013
+#define OP_ADDIW 0x0000001b
+#define OP_SLLI 0x00001013
+#define OP_SRLI 0x00005013
+#define OP_LUI 0x00000037
+#define OP_AUIPC 0x00000017
+#define OP_JAL 0x0000006f
+#define OP_JALR 0x00000067
+
+// Instruction table. The operands are described by the following letters.
+//
+//   d, s, t: rd, rs1 and rs2 (integer registers)
+//   D, S, T: rd, rs1 and rs2 (floating-point registers)
+//   j: 12-bit signed immediate or %tprel_lo(sym)
+//   >: shift amount
+//   u: 20-bit upper immediate or %tprel_hi(sym)
+//   o: imm(rs1) for loads
+//   q: imm(rs1) for stores
+//   p: branch target
+//   a: jump target
+//   m: optional rounding mode (the default is dyn)
+typedef struct Insn Insn;
+struct Insn
+{
+  char *name;
+  char *args;
+  unsigned int match;
+};
+
+static Insn insns[] = {
+  {"lui", "d,u", 0x00000037},
+  {"auipc", "d,u", 0x00000017},
+  {"jal", "d,a", 0x0000006f},
+  {"beq", "s,t,p", 0x00000063},
+  {"bne", "s,t,p", 0x00001063},
+  {"blt", "s,t,p", 0x00004063},
+  {"bge", "s,t,p", 0x00005063},
+  {"bltu", "s,t,p", 0x00006063},
+  {"bgeu", "s,t,p", 0x00007063},
+  {"lb", "d,o", 0x00000003},
+  {"lh", "d,o", 0x00001003},
+  {"lw", "d,o", 0x00002003},
+  {"ld", "d,o", 0x00003003},
+  {"lbu", "d,o", 0x00004003},
+  {"lhu", "d,o", 0x00005003},
+  {"lwu", "d,o", 0x00006003},
+  {"sb", "t,q", 0x00000023},
+  {"sh", "t,q", 0x00001023},
+  {"sw", "t,q", 0x00002023},
+  {"sd", "t,q", 0x00003023},
+  {"addi", "d,s,j", 0x00000013},
+  {"slti", "d,s,j", 0x00002013},
+  {"sltiu", "d,s,j", 0x00003013},
+  {"xori", "d,s,j", 0x00004013},
+  {"ori", "d,s,j", 0x00006013},
+  {"andi", "d,s,j", 0x00007013},
+  {"slli", "d,s,>", 0x00001013},
+  {"srli", "d,s,>", 0x00005013},
+  {"srai", "d,s,>", 0x40005013},
+  {"addiw", "d,s,j", 0x0000001b},
+  {"add", "d,s,t", 0x00000033},
+  {"sub", "d,s,t", 0x40000033},
+  {"sll", "d,s,t", 0x00001033},
+  {"slt", "d,s,t", 0x00002033},
+  {"sltu", "d,s,t", 0x00003033},
+  {"xor", "d,s,t", 0x00004033},
+  {"srl", "d,s,t", 0x00005033},
+  {"sra", "d,s,t", 0x40005033},
+  {"or", "d,s,t", 0x00006033},
+  {"and", "d,s,t", 0x00007033},
+  {"addw", "d,s,t", 0x0000003b},
+  {"subw", "d,s,t", 0x4000003b},
+  {"mul", "d,s,t", 0x02000033},
+  {"mulh", "d,s,t", 0x02001033},
+  {"mulhu", "d,s,t", 0x02003033},
+  {"div", "d,s,t", 0x02004033},
+  {"divu", "d,s,t", 0x02005033},
+  {"rem", "d,s,t", 0x02006033},
+  {"remu", "d,s,t", 0x02007033},
+  {"mulw", "d,s,t", 0x0200003b},
+  {"divw", "d,s,t", 0x0200403b},
+  {"divuw", "d,s,t", 0x0200503b},
+  {"remw", "d,s,t", 0x0200603b},
+  {"remuw", "d,s,t", 0x0200703b},
+  {"flw", "D,o", 0x00002007},
+  {"fld", "D,o", 0x00003007},
+  {"fsw", "T,q", 0x00002027},
+  {"fsd", "T,q", 0x00003027},
+  {"fadd.s", "D,S,T,m", 0x00000053},
+  {"fsub.s", "D,S,T,m", 0x08000053},
+  {"fmul.s", "D,S,T,m", 0x10000053},
+  {"fdiv.s", "D,S,T,m", 0x18000053},
+  {"fadd.d", "D,S,T,m", 0x02000053},
+  {"fsub.d", "D,S,T,m", 0x0a000053},
+  {"fmul.d", "D,S,T,m", 0x12000053},
+  {"fdiv.d", "D,S,T,m", 0x1a000053},
+  {"fsgnj.s", "D,S,T", 0x20000053},
+  {"fsgnjn.s", "D,S,T", 0x20001053},
+  {"fsgnjx.s", "D,S,T", 0x20002053},
+  {"fsgnj.d", "D,S,T", 0x22000053},
+  {"fsgnjn.d", "D,S,T", 0x22001053},
+  {"fsgnjx.d", "D,S,T", 0x22002053},
+  {"feq.s", "d,S,T", 0xa0002053},
+  {"flt.s", "d,S,T", 0xa0001053},
+  {"fle.s", "d,S,T", 0xa0000053},
+  {"feq.d", "d,S,T", 0xa2002053},
+  {"flt.d", "d,S,T", 0xa2001053},
+  {"fle.d", "d,S,T", 0xa2000053},
+  {"fcvt.w.s", "d,S,m", 0xc0000053},
+  {"fcvt.wu.s", "d,S,m", 0xc0100053},
+  {"fcvt.l.s", "d,S,m", 0xc0200053},
+  {"fcvt.lu.s", "d,S,m", 0xc0300053},
+  {"fcvt.w.d", "d,S,m", 0xc2000053},
+  {"fcvt.wu.d", "d,S,m", 0xc2100053},
+  {"fcvt.l.d", "d,S,m", 0xc2200053},
+  {"fcvt.lu.d", "d,S,m", 0xc2300053},
+  {"fcvt.s.w", "D,s,m", 0xd0000053},
+  {"fcvt.s.wu", "D,s,m", 0xd0100053},
+  {"fcvt.s.l", "D,s,m", 0xd0200053},
+  {"fcvt.s.lu", "D,s,m", 0xd0300053},
+  {"fcvt.d.w", "D,s", 0xd2000053},
+  {"fcvt.d.wu", "D,s", 0xd2100053},
+  {"fcvt.d.l", "D,s,m", 0xd2200053},
+  {"fcvt.d.lu", "D,s,m", 0xd2300053},
+  {"fcvt.s.d", "D,S,m", 0x40100053},
+  {"fcvt.d.s", "D,S", 0x42000053},
+  {"fmv.x.w", "d,S", 0xe0000053},
+  {"fmv.x.s", "d,S", 0xe0000053},
+  {"fmv.x.d", "d,S", 0xe2000053},
+  {"fmv.w.x", "D,s", 0xf0000053},
+  {"fmv.s.x", "D,s", 0xf0000053},
+  {"fmv.d.x", "D,s", 0xf2000053},
+};
+
+static HashMap insn_map;
+
+static Insn *find_insn(char *name)
+{
+  if (!insn_map.capacity)
+    for (int i = 0; i < sizeof(insns) / sizeof(*insns); i++)
+      hashmap_put(&insn_map, insns[i].name, &insns[i]);
+  return hashmap_get(&insn_map, name);
+}
+
+static void emit_branch(unsigned int match, int rs1, int rs2, char *target)
+{
+  long addend;
+  Symbol *sym = symbol_operand(target, &addend);
+  add_fixup(cur_sec, cur_sec->buf.len, R_RISCV_BRANCH, sym, addend);
+  emit_insn(enc_b(match, rs1, rs2, 0));
+}
+
+static void emit_jal(int rd, char *target)
+{
+  long addend;
+  Symbol *sym = symbol_operand(target, &addend);
+  add_fixup(cur_sec, cur_sec->buf.len, R_RISCV_JAL, sym, addend);
+  emit_insn(enc_j(OP_JAL, rd, 0));
+}
+
+static void assemble_insn(Insn *insn, char **args, int nargs)
+{
+  unsigned int code = insn->match;
+  int i = 0;
+
+  for (char *p = insn->args; *p; p++)
+  {
+    if (*p == ',')
+      continue;
+
+    if (i == nargs)
+    {
+      // The rounding mode can be omitted.
+      if (*p == 'm')
+      {
+        code |= 7 << 12;
+        continue;
+      }
+      error("assembler: %s: too few operands", cur_line);
+    }
+
+    char *arg = args[i++];
+    long val;
+    switch (*p)
+    {
+    case 'd':
+      code |= xreg(arg) << 7;
+      break;
+    case 's':
+      code |= xreg(arg) << 15;
+      break;
+    case 't':
+      code |= xreg(arg) << 20;
+      break;
+    case 'D':
+      code |= freg(arg) << 7;
+      break;
+    case 'S':
+      code |= freg(arg) << 15;
+      break;
+    case 'T':
+      code |= freg(arg) << 20;
+      break;
+    case 'j':
+      if (!reloc_operand(arg, "tprel_lo", R_RISCV_TPREL_LO12_I))
+        code = enc_i(code, 0, 0, imm_range(arg, -2048, 2047));
+      break;
+    case '>':
+      code |= imm_range(arg, 0, 63) << 20;
+      break;
+    case 'u':
+      if (!reloc_operand(arg, "tprel_hi", R_RISCV_TPREL_HI20))
+        code = enc_u(code, 0, imm_range(arg, 0, 0xfffff));
+      break;
+    case 'o':
+      code |= mem_operand(arg, &val) << 15;
+      code = enc_i(code, 0, 0, val);
+      break;
+    case 'q':
+      code |= mem_operand(arg, &val) << 15;
+      code = enc_s(code, 0, 0, val);
+      break;
+    case 'm':
+      code |= rounding_mode(arg) << 12;
+      break;
+    case 'p':
+    {
+      Symbol *sym = symbol_operand(arg, &val);
+      add_fixup(cur_sec, cur_sec->buf.len, R_RISCV_BRANCH, sym, val);
+      break;
+    }
+    case 'a':
+    {
+      Symbol *sym = symbol_operand(arg, &val);
+      add_fixup(cur_sec, cur_sec->buf.len, R_RISCV_JAL, sym, val);
+      break;
+    }
+    default:
+      error("internal error: unknown operand type: %c", *p);
+    }
+  }
+
+  if (i != nargs)
+    error("assembler: %s: too many operands", cur_line);
+  emit_insn(code);
+}
+
+static long sign_extend(unsigned long val, int bits)
+{
+  return (long)(val << (64 - bits)) >> (64 - bits);
+}
+
+// The longest sequence to load a constant
+#define LI_SEQ_MAX 10
+
+// An instruction of a sequence to load a constant
+typedef struct LiInsn LiInsn;
+struct LiInsn
+{
+  unsigned int op; // OP_LUI, OP_ADDI, OP_ADDIW, OP_SLLI or OP_SRLI
+  long imm;
+};
+
+static int li_seq2(long val, LiInsn *seq, int n)
+{
+  if (val == (int)val)
+  {
+    long hi20 = ((val + 0x800) >> 12) & 0xfffff;
+    long lo12 = sign_extend(val, 12);
+
+    if (hi20)
+    {
+      seq[n].op = OP_LUI;
+      seq[n++].imm = hi20;
+    }
+    if (lo12 || !hi20)
+    {
+      seq[n].op = hi20 ? OP_ADDIW : OP_ADDI;
+      seq[n++].imm = lo12;
+    }
+    return n;
+  }
+
+  // Load the upper bits recursively, then shift them and add
+  // the lower 12 bits.
+  long lo12 = sign_extend(val, 12);
+  unsigned long hi52 = ((unsigned long)val + 0x800) >> 12;
+  int shift = 12;
+  while (!(hi52 & 1))
+  {
+    hi52 = hi52 >> 1;
+    shift++;
+  }
+  long hi = sign_extend(hi52, 64 - shift);
+
+  // If the upper bits don't fit in 12 bits, we might be able to
+  // reduce the shift amount to use LUI which zeros the lower 12 bits.
+  long lui_hi = (unsigned long)hi << 12;
+  if (shift > 12 && (hi < -2048 || 2047 < hi) && lui_hi == (int)lui_hi)
+  {
+    shift -= 12;
+    hi = lui_hi;
+  }
+
+  n = li_seq2(hi, seq, n);
+  seq[n].op = OP_SLLI;
+  seq[n++].imm = shift;
+  if (lo12)
+  {
+    seq[n].op = OP_ADDI;
+    seq[n++].imm = lo12;
+  }
+  return n;
+}
+
+// Compute a sequence to load an arbitrary 64-bit constant into
+// `seq` and return its length. This produces the same sequence as
+// LLVM's RISCVMatInt does for RV64IMFD.
+static int li_seq(long val, LiInsn *seq)
+{
+  int n = li_seq2(val, seq, 0);
+  if (val <= 0 || n <= 2)
+    return n;
+
+  // If the constant is positive, we might be able to load a shifted
+  // constant with no leading zeros and restore them with SRLI. The
+  // bits shifted out are filled with ones first, then with zeros.
+  int lz = 0;
+  while (!((unsigned long)val << lz >> 63))
+    lz++;
+
+  for (int i = 0; i < 2; i++)
+  {
+    unsigned long shifted = (unsigned long)val << lz;
+    if (i == 0)
+      shifted |= (1UL << lz) - 1;
+
+    LiInsn tmp[LI_SEQ_MAX];
+    int m = li_seq2(shifted, tmp, 0);
+    tmp[m].op = OP_SRLI;
+    tmp[m++].imm = lz;
+
+    if (m < n)
+    {
+      memcpy(seq, tmp, sizeof(LiInsn) * m);
+      n = m;
+      if (n <= 2)
+        return n;
+    }
+  }
+  return n;
+}
+
+static void gen_li(int rd, long val)
+{
+  LiInsn seq[LI_SEQ_MAX];
+  int n = li_seq(val, seq);
+  int rs = 0;
+
+  for (int i = 0; i < n; i++)
+  {
+    if (seq[i].op == OP_LUI)
+      emit_insn(enc_u(OP_LUI, rd, seq[i].imm));
+    else
+      emit_insn(enc_i(seq[i].op, rd, rs, seq[i].imm));
+    rs = rd;
+  }
+}
+
+// la rd, sym
+//
+//   .Lpcrel_hiN:
+//     auipc rd, %pcrel_hi(sym)
+//     addi rd, rd, %pcrel_lo(.Lpcrel_hiN)
+static void gen_la(int rd, char *target)
+{
+  long addend;
+  Symbol *sym = symbol_operand(target, &addend);
+
+  char name[32];
+  sprintf(name, ".Lpcrel_hi%d", pcrel_seq++);
+  define_label(name);
+  Symbol *hi = get_symbol(name);
+  hi->keep = true;
+
+  add_fixup(cur_sec, cur_sec->buf.len, R_RISCV_PCREL_HI20, sym, addend);
+  emit_insn(enc_u(OP_AUIPC, rd, 0));
+  add_fixup(cur_sec, cur_sec->buf.len, R_RISCV_PCREL_LO12_I, hi, 0);
+  emit_insn(enc_i(OP_ADDI, rd, rd, 0));
+}
+
+static void expect_args(char *op, int nargs, int n)
+{
+  if (nargs != n)
+    error("assembler: %s: %s takes %d operand(s)", cur_line, op, n);
+}
+
+// Returns true if `op` is a pseudo instruction.
+static bool assemble_pseudo(char *op, char **args, int nargs)
+{
+  if (!strcmp(op, "li"))
+  {
+    expect_args(op, nargs, 2);
+    gen_li(xreg(args[0]), imm(args[1]));
+    return true;
+  }
+
+  if (!strcmp(op, "la") || !strcmp(op, "lla"))
+  {
+    expect_args(op, nargs, 2);
+    gen_la(xreg(args[0]), args[1]);
+    return true;
+  }
+
+  // add rd, rs1, tp, %tprel_add(sym)
+  if (!strcmp(op, "add") && nargs == 4)
+  {
+    if (!reloc_operand(args[3], "tprel_add", R_RISCV_TPREL_ADD))
+      error("assembler: %s: invalid operand: %s", cur_line, args[3]);
+    emit_insn(enc_r(0x00000033, xreg(args[0]), xreg(args[1]), xreg(args[2])));
+    return true;
+  }
+
+  if (!strcmp(op, "mv"))
+  {
+    expect_args(op, nargs, 2);
+    emit_insn(enc_i(OP_ADDI, xreg(args[0]), xreg(args[1]), 0));
+    return true;
+  }
+
+  if (!strcmp(op, "not"))
+  {
+    expect_args(op, nargs, 2);
+    emit_insn(enc_i(0x00004013, xreg(args[0]), xreg(args[1]), -1));
+    return true;
+  }
+
+  if (!strcmp(op, "neg"))
+  {
+    expect_args(op, nargs, 2);
+    emit_insn(enc_r(0x40000033, xreg(args[0]), 0, xreg(args[1])));
+    return true;
+  }
+
+  if (!strcmp(op, "seqz"))
+  {
+    expect_args(op, nargs, 2);
+    emit_insn(enc_i(0x00003013, xreg(args[0]), xreg(args[1]), 1));
+    return true;
+  }
+
+  if (!strcmp(op, "snez"))
+  {
+    expect_args(op, nargs, 2);
+    emit_insn(enc_r(0x00003033, xreg(args[0]), 0, xreg(args[1])));
+    return true;
+  }
+
+  if (!strcmp(op, "nop"))
+  {
+    expect_args(op, nargs, 0);
+    emit_insn(OP_ADDI);
+    return true;
+  }
+
+  if (!strcmp(op, "beqz") || !strcmp(op, "bnez"))
+  {
+    expect_args(op, nargs, 2);
+    emit_branch(op[1] == 'e' ? 0x00000063 : 0x00001063, xreg(args[0]), 0, args[1]);
+    return true;
+  }
+
+  if (!strcmp(op, "j"))
+  {
+    expect_args(op, nargs, 1);
+    emit_jal(0, args[0]);
+    return true;
+  }
+
+  if (!strcmp(op, "jal") && nargs == 1)
+  {
+    emit_jal(1, args[0]);
+    return true;
+  }
+
+  if (!strcmp(op, "jalr"))
+  {
+    // jalr rs
+    if (nargs == 1)
+    {
+      emit_insn(enc_i(OP_JALR, 1, xreg(args[0]), 0));
+      return true;
+    }
+
+    // jalr rd, imm(rs) or jalr rd, rs, imm
+    if (nargs == 2 && strchr(args[1], '('))
+    {
+      long offset;
+      int rs = mem_operand(args[1], &offset);
+      emit_insn(enc_i(OP_JALR, xreg(args[0]), rs, offset));
+      return true;
+    }
+    expect_args(op, nargs, 3);
+    emit_insn(enc_i(OP_JALR, xreg(args[0]), xreg(args[1]), imm_range(args[2], -2048, 2047)));
+    return true;
+  }
+
+  if (!strcmp(op, "ret"))
+  {
+    expect_args(op, nargs, 0);
+    emit_insn(enc_i(OP_JALR, 0, 1, 0));
+    return true;
+  }
+
+  // fmv.s, fmv.d, fneg.s and fneg.d
+  if (!strcmp(op, "fmv.s") || !strcmp(op, "fmv.d") ||
+      !strcmp(op, "fneg.s") || !strcmp(op, "fneg.d"))
+  {
+    expect_args(op, nargs, 2);
+    unsigned int match = (op[1] == 'm') ? 0x20000053 : 0x20001053;
+    if (op[strlen(op) - 1] == 'd')
+      match |= 0x02000000;
+    int rs = freg(args[1]);
+    emit_insn(enc_r(match, freg(args[0]), rs, rs));
+    return true;
+  }
+
+  return false;
+}
+
+/*** Directives ***/
+
+// .file N "path"
+static void file_directive(char *p)
+{
+  char *end;
+  long file_no = strtol(p, &end, 10);
+  if (end == p)
+    return; // .file "name" is not used by the line number table.
+
+  p = end;
+  while (isspace(*p))
+    p++;
+  int len = strlen(p);
+  if (*p != '"' || len < 2 || p[len - 1] != '"' || file_no <= 0)
+    error("assembler: %s: invalid .file directive", cur_line);
+
+  files = reserve(files, &file_cap, file_no + 1, sizeof(char *));
+  while (nfiles <= file_no)
+    files[nfiles++] = NULL;
+  files[file_no] = strndup(p + 1, len - 2);
+}
+
+// .ascii "str"[, "str"...], and .string and .asciz, which append '\0'
+// to each string.
+static void string_directive(char *p, bool add_nul)
+{
+  if (cur_sec->type == SHT_NOBITS)
+    error("assembler: %s: data in a nobits section", cur_line);
+
+  for (;;)
+  {
+    if (*p++ != '"')
+      error("assembler: %s: expected a string", cur_line);
+
+    while (*p != '"')
+    {
+      if (!*p)
+        error("assembler: %s: unclosed string", cur_line);
+      if (*p != '\\')
+      {
+        buf_u8(&cur_sec->buf, *p++);
+        continue;
+      }
+
+      p++;
+      if ('0' <= *p && *p <= '7')
+      {
+        int c = 0;
+        for (int i = 0; i < 3 && '0' <= *p && *p <= '7'; i++)
+          c = c * 8 + *p++ - '0';
+        buf_u8(&cur_sec->buf, c);
+        continue;
+      }
+
+      switch (*p)
+      {
+      case 'b': buf_u8(&cur_sec->buf, '\b'); break;
+      case 'f': buf_u8(&cur_sec->buf, '\f'); break;
+      case 'n': buf_u8(&cur_sec->buf, '\n'); break;
+      case 'r': buf_u8(&cur_sec->buf, '\r'); break;
+      case 't': buf_u8(&cur_sec->buf, '\t'); break;
+      case '\0': error("assembler: %s: unclosed string", cur_line);
+      default: buf_u8(&cur_sec->buf, *p);
+      }
+      p++;
+    }
+    p++;
+    if (add_nul)
+      buf_u8(&cur_sec->buf, 0);
+
+    while (isspace(*p))
+      p++;
+    if (!*p)
+      return;
+    if (*p++ != ',')
+      error("assembler: %s: expected ','", cur_line);
+    while (isspace(*p))
+      p++;
+  }
+}
+
+static void align_to_pow2(int n)
+{
+  int align = 1 << n;
+  if (cur_sec->align < align)
+    cur_sec->align = align;
+
+  if (cur_sec->type == SHT_NOBITS)
+  {
+    cur_sec->buf.len = align_to(cur_sec->buf.len, align);
+    return;
+  }
+
+  if (cur_sec->flags & SHF_EXECINSTR)
+    while (cur_sec->buf.len % align && cur_sec->buf.len % 4 == 0)
+      buf_uint(&cur_sec->buf, OP_ADDI, 4);
+  buf_align(&cur_sec->buf, align);
+}
+
+static void assemble_directive(char *op, char *rest, char **args, int nargs)
+{
+  if (!strcmp(op, ".text") || !strcmp(op, ".data") || !strcmp(op, ".bss"))
+  {
+    cur_sec = get_section(op);
+    return;
+  }
+
+  // .section name[,flags,type]. The flags and the type of the
+  // sections we know are fixed, so they are ignored.
+  if (!strcmp(op, ".section"))
+  {
+    if (nargs < 1)
+      expect_args(op, nargs, 1);
+    cur_sec = get_section(args[0]);
+    return;
+  }
+
+  if (!strcmp(op, ".globl") || !strcmp(op, ".global"))
+  {
+    expect_args(op, nargs, 1);
+    get_symbol(args[0])->is_global = true;
+    return;
+  }
+
+  if (!strcmp(op, ".align") || !strcmp(op, ".p2align"))
+  {
+    expect_args(op, nargs, 1);
+    align_to_pow2(imm_range(args[0], 0, 12));
+    return;
+  }
+
+  if (!strcmp(op, ".zero"))
+  {
+    expect_args(op, nargs, 1);
+    emit_zero(imm_range(args[0], 0, 1 << 30));
+    return;
+  }
+
+  if (!strcmp(op, ".byte") || !strcmp(op, ".half") ||
+      !strcmp(op, ".word") || !strcmp(op, ".quad"))
+  {
+    if (cur_sec->type == SHT_NOBITS)
+      error("assembler: %s: data in a nobits section", cur_line);
+
+    int size = (op[1] == 'b') ? 1 : (op[1] == 'h') ? 2 : (op[1] == 'w') ? 4 : 8;
+    for (int i = 0; i < nargs; i++)
+    {
+      // Symbol references are allowed only for .quad.
+      if (size == 8 && !isdigit(*args[i]) && *args[i] != '-' && *args[i] != '+')
+      {
+        long addend;
+        Symbol *sym = symbol_operand(args[i], &addend);
+        add_fixup(cur_sec, cur_sec->buf.len, R_RISCV_64, sym, addend);
+        buf_uint(&cur_sec->buf, 0, 8);
+        continue;
+      }
+      buf_uint(&cur_sec->buf, imm(args[i]), size);
+    }
+    return;
+  }
+
+  if (!strcmp(op, ".file"))
+  {
+    file_directive(rest);
+    return;
+  }
+
+  // .loc file line [column]
+  if (!strcmp(op, ".loc"))
+  {
+    char *p = rest;
+    loc_file_no = strtol(p, &p, 10);
+    loc_line_no = strtol(p, &p, 10);
+    has_loc = true;
+    return;
+  }
+
+  error("assembler: %s: unknown directive", cur_line);
+}
+
+// Assemble a line of the assembly text.
+void assemble_line(char *line)
+{
+  if (!initialized)
+    init();
+  cur_line = line;
+
+  char *p = line;
+  while (isspace(*p))
+    p++;
+  if (!*p || *p == '#')
+    return;
+
+  // Label
+  char *q = p;
+  while (is_ident_char(*q))
+    q++;
+  if (q != p && *q == ':')
+  {
+    char *name = strndup(p, q - p);
+    define_label(name);
+    free(name);
+    p = q + 1;
+    while (isspace(*p))
+      p++;
+    if (!*p || *p == '#')
+      return;
+  }
+
+  // Mnemonic or directive name
+  q = p;
+  while (*q && !isspace(*q))
+    q++;
+  char *op = strndup(p, q - p);
+  while (isspace(*q))
+    q++;
+  char *rest = q;
+
+  // Strings may contain commas, so they are not split into operands.
+  if (!strcmp(op, ".ascii") || !strcmp(op, ".string") || !strcmp(op, ".asciz"))
+  {
+    string_directive(rest, strcmp(op, ".ascii"));
+    free(op);
+    return;
+  }
+
+  // Split operands by commas.
+  char *buf = strdup(rest);
+  char *args[8];
+  int nargs = 0;
+  for (char *s = buf; *s;)
+  {
+    if (nargs == sizeof(args) / sizeof(*args))
+      error("assembler: %s: too many operands", cur_line);
+
+    while (isspace(*s))
+      s++;
+    char *start = s;
+    while (*s && *s != ',')
+      s++;
+    char *end = s;
+    while (start < end && isspace(end[-1]))
+      end--;
+    if (*s == ',')
+      s++;
+    *end = '\0';
+    args[nargs++] = start;
+  }
+
+  if (*op == '.')
+    assemble_directive(op, rest, args, nargs);
+  else if (!assemble_pseudo(op, args, nargs))
+  {
+    Insn *insn = find_insn(op);
+    if (!insn)
+      error("assembler: %s: unknown instruction", cur_line);
+    assemble_insn(insn, args, nargs);
+  }
+
+  free(op);
+  free(buf);
+}
+
+/*** Branch relaxation and fixup resolution ***/
+
+static bool is_resolvable(Section *sec, Fixup *fx)
+{
+  return (fx->type == R_RISCV_BRANCH || fx->type == R_RISCV_JAL) &&
+         fx->sym->sec == sec && !fx->sym->is_global;
+}
+
+// The number of long branches before `offset`
+static int count_long_branches(Section *sec, int *nlong, int offset)
+{
+  // Binary search for the first fixup at or after `offset`.
+  int lo = 0, hi = sec->nfixups;
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+    if (sec->fixups[mid]->offset < offset)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return nlong[lo];
+}
+
+static int shift_offset(Section *sec, int *nlong, int offset)
+{
+  return offset + 4 * count_long_branches(sec, nlong, offset);
+}
+
+// A conditional branch can reach only +-4KiB. If the target is out of
+// the range, we replace it with an inverted branch over a jump, e.g.
+//
+//   beq a0, a1, L   =>   bne a0, a1, 8
+//                        jal zero, L
+//
+// Since such expansion moves the following code, we repeat it until
+// no more branch needs it.
+static void relax_branches(Section *sec)
+{
+  // nlong[i] is the number of long branches in fixups[0] ~ fixups[i - 1].
+  int *nlong = calloc(sec->nfixups + 1, sizeof(int));
+  bool changed = true;
+  bool has_long = false;
+
+  while (changed)
+  {
+    changed = false;
+    for (int i = 0; i < sec->nfixups; i++)
+      nlong[i + 1] = nlong[i] + sec->fixups[i]->is_long;
+
+    for (int i = 0; i < sec->nfixups; i++)
+    {
+      Fixup *fx = sec->fixups[i];
+      if (fx->type != R_RISCV_BRANCH || fx->is_long || !is_resolvable(sec, fx))
+        continue;
+
+      long disp = shift_offset(sec, nlong, fx->sym->offset + fx->addend) -
+                  shift_offset(sec, nlong, fx->offset);
+      if (disp < -4096 || 4095 < disp)
+      {
+        fx->is_long = true;
+        changed = true;
+        has_long = true;
+      }
+    }
+  }
+
+  if (!has_long)
+  {
+    free(nlong);
+    return;
+  }
+
+  // Move the contents and insert room for the jumps.
+  Buffer buf = {};
+  int pos = 0;
+  for (int i = 0; i < sec->nfixups; i++)
+  {
+    Fixup *fx = sec->fixups[i];
+    if (!fx->is_long)
+      continue;
+    buf_push(&buf, sec->buf.data + pos, fx->offset + 4 - pos);
+    buf_uint(&buf, 0, 4);
+    pos = fx->offset + 4;
+  }
+  buf_push(&buf, sec->buf.data + pos, sec->buf.len - pos);
+
+  // Adjust the offsets of the symbols, the line number table and the fixups.
+  for (int i = 0; i < nsymbols; i++)
+    if (symbols[i]->sec == sec)
+      symbols[i]->offset = shift_offset(sec, nlong, symbols[i]->offset);
+
+  if (sec == text_sec)
+    for (int i = 0; i < nrows; i++)
+      rows[i].offset = shift_offset(sec, nlong, rows[i].offset);
+
+  for (int i = 0; i < sec->nfixups; i++)
+    sec->fixups[i]->offset += 4 * nlong[i];
+
+  free(sec->buf.data);
+  sec->buf = buf;
+  free(nlong);
+}
+
+static void resolve_fixups(Section *sec)
+{
+  for (int i = 0; i < sec->nfixups; i++)
+  {
+    Fixup *fx = sec->fixups[i];
+    if (!is_resolvable(sec, fx))
+      continue;
+
+    char *p = sec->buf.data + fx->offset;
+    unsigned int insn = read_u32(p);
+    long disp = fx->sym->offset + fx->addend - fx->offset;
+
+    if (fx->is_long)
+    {
+      // Invert the condition and jump over the following jal.
+      write_u32(p, enc_b((insn & 0x1fff07f) ^ 0x1000, 0, 0, 8));
+      insn = OP_JAL;
+      p += 4;
+      disp -= 4;
+    }
+
+    if (fx->type == R_RISCV_BRANCH && !fx->is_long)
+    {
+      write_u32(p, enc_b(insn & 0x1fff07f, 0, 0, disp));
+    }
+    else
+    {
+      if (disp < -(1 << 20) || (1 << 20) <= disp)
+        error("assembler: jump target out of range: %s", fx->sym->name);
+      write_u32(p, enc_j(insn & 0xfff, 0, disp));
+    }
+    fx->resolved = true;
+  }
+}
+
+/*** Debug information ***/
+
+// DWARF constants
+#define DW_TAG_compile_unit 0x11
+#define DW_CHILDREN_no 0
+#define DW_AT_name 0x03
+#define DW_AT_stmt_list 0x10
+#define DW_AT_low_pc 0x11
+#define DW_AT_high_pc 0x12
+#define DW_AT_language 0x13
+#define DW_AT_producer 0x25
+#define DW_FORM_addr 0x01
+#define DW_FORM_data2 0x05
+#define DW_FORM_data4 0x06
+#define DW_FORM_string 0x08
+#define DW_LANG_C99 0x0c
+#define DW_LNS_copy 1
+#define DW_LNS_advance_pc 2
+#define DW_LNS_advance_line 3
+#define DW_LNS_set_file 4
+#define DW_LNE_end_sequence 1
+#define DW_LNE_set_address 2
+
+// Build a DWARF line number table from .loc directives.
+static void emit_debug_line()
+{
+  Section *sec = get_section(".debug_line");
+  Buffer *buf = &sec->buf;
+
+  buf_uint(buf, 0, 4);         // unit_length (filled later)
+  buf_uint(buf, 3, 2);         // version
+  buf_uint(buf, 0, 4);         // header_length (filled later)
+  int header_start = buf->len;
+  buf_u8(buf, 1);              // minimum_instruction_length
+  buf_u8(buf, 1);              // default_is_stmt
+  buf_u8(buf, -5);             // line_base
+  buf_u8(buf, 14);             // line_range
+  buf_u8(buf, 13);             // opcode_base
+
+  // standard_opcode_lengths
+  static char opcode_lengths[] = {0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1};
+  buf_push(buf, opcode_lengths, sizeof(opcode_lengths));
+
+  // include_directories (empty, since file names are absolute)
+  buf_u8(buf, 0);
+
+  // file_names
+  for (int i = 1; i < nfiles && files[i]; i++)
+  {
+    buf_str(buf, files[i]);
+    buf_uleb(buf, 0); // directory
+    buf_uleb(buf, 0); // modification time
+    buf_uleb(buf, 0); // length
+  }
+  buf_u8(buf, 0);
+  write_u32(buf->data + 6, buf->len - header_start);
+
+  // DW_LNE_set_address
+  buf_u8(buf, 0);
+  buf_uleb(buf, 9);
+  buf_u8(buf, DW_LNE_set_address);
+  add_fixup(sec, buf->len, R_RISCV_64, text_sec->sym, 0);
+  buf_uint(buf, 0, 8);
+
+  int addr = 0;
+  int file_no = 1;
+  int line_no = 1;
+  for (int i = 0; i < nrows; i++)
+  {
+    LineRow *row = &rows[i];
+    if (row->file_no != file_no)
+    {
+      buf_u8(buf, DW_LNS_set_file);
+      buf_uleb(buf, row->file_no);
+      file_no = row->file_no;
+    }
+
+    int line_delta = row->line_no - line_no;
+    int addr_delta = row->offset - addr;
+    int opcode = (line_delta + 5) + 14 * addr_delta + 13;
+
+    if (-5 <= line_delta && line_delta < 9 && opcode <= 255)
+    {
+      // Special opcode
+      buf_u8(buf, opcode);
+    }
+    else
+    {
+      if (addr_delta)
+      {
+        buf_u8(buf, DW_LNS_advance_pc);
+        buf_uleb(buf, addr_delta);
+      }
+      if (line_delta)
+      {
+        buf_u8(buf, DW_LNS_advance_line);
+        buf_sleb(buf, line_delta);
+      }
+      buf_u8(buf, DW_LNS_copy);
+    }
+    addr = row->offset;
+    line_no = row->line_no;
+  }
+
+  // DW_LNE_end_sequence
+  if (text_sec->buf.len > addr)
+  {
+    buf_u8(buf, DW_LNS_advance_pc);
+    buf_uleb(buf, text_sec->buf.len - addr);
+  }
+  buf_u8(buf, 0);
+  buf_uleb(buf, 1);
+  buf_u8(buf, DW_LNE_end_sequence);
+
+  write_u32(buf->data, buf->len - 4);
+}
+
+// A compilation unit which refers to the line number table, so that
+// debuggers can find it.
+static void emit_debug_info()
+{
+  Section *abbrev = get_section(".debug_abbrev");
+  buf_uleb(&abbrev->buf, 1); // abbreviation code
+  buf_uleb(&abbrev->buf, DW_TAG_compile_unit);
+  buf_u8(&abbrev->buf, DW_CHILDREN_no);
+  int attrs[] = {
+    DW_AT_stmt_list, DW_FORM_data4,
+    DW_AT_low_pc, DW_FORM_addr,
+    DW_AT_high_pc, DW_FORM_addr,
+    DW_AT_name, DW_FORM_string,
+    DW_AT_producer, DW_FORM_string,
+    DW_AT_language, DW_FORM_data2,
+    0, 0,
+  };
+  for (int i = 0; i < sizeof(attrs) / sizeof(*attrs); i++)
+    buf_uleb(&abbrev->buf, attrs[i]);
+  buf_u8(&abbrev->buf, 0);
+
+  Section *sec = get_section(".debug_info");
+  Buffer *buf = &sec->buf;
+  buf_uint(buf, 0, 4); // unit_length (filled later)
+  buf_uint(buf, 3, 2); // version
+  add_fixup(sec, buf->len, R_RISCV_32, abbrev->sym, 0);
+  buf_uint(buf, 0, 4); // debug_abbrev_offset
+  buf_u8(buf, 8);      // address_size
+
+  buf_uleb(buf, 1);
+  add_fixup(sec, buf->len, R_RISCV_32, get_section(".debug_line")->sym, 0);
+  buf_uint(buf, 0, 4);
+  add_fixup(sec, buf->len, R_RISCV_64, text_sec->sym, 0);
+  buf_uint(buf, 0, 8);
+  add_fixup(sec, buf->len, R_RISCV_64, text_sec->sym, text_sec->buf.len);
+  buf_uint(buf, 0, 8);
+  buf_str(buf, files[1]);
+  buf_str(buf, "kiwicc");
+  buf_uint(buf, DW_LANG_C99, 2);
+
+  write_u32(buf->data, buf->len - 4);
+}
+
+/*** ELF writer ***/
+
+static void add_string(Buffer *strtab, char *s, int *offset)
+{
+  *offset = strtab->len;
+  buf_str(strtab, s);
+}
+
+static void add_elf_symbol(Buffer *symtab, Buffer *strtab, Symbol *sym, int bind)
+{
+  Elf64_Sym esym = {};
+  if (sym->is_section)
+  {
+    esym.st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+  }
+  else
+  {
+    int name;
+    add_string(strtab, sym->name, &name);
+    esym.st_name = name;
+    esym.st_info = ELF64_ST_INFO(bind, sym->is_tls ? STT_TLS : STT_NOTYPE);
+    esym.st_value = sym->offset;
+  }
+  esym.st_shndx = sym->sec ? sym->sec->shndx : SHN_UNDEF;
+  sym->index = symtab->len / sizeof(Elf64_Sym);
+  buf_push(symtab, &esym, sizeof(esym));
+}
+
+static bool is_local_symbol(Symbol *sym)
+{
+  return !sym->is_global && sym->sec;
+}
+
+static bool needs_symbol_entry(Symbol *sym)
+{
+  if (!is_local_label(sym->name) || sym->keep)
+    return true;
+  if (!sym->sec)
+    error("assembler: undefined label: %s", sym->name);
+  return false;
+}
+
+static int count_relocations(Section *sec)
+{
+  int n = 0;
+  for (int i = 0; i < sec->nfixups; i++)
+    if (!sec->fixups[i]->resolved)
+      n++;
+  return n;
+}
+
+static void add_section_header(Buffer *shdrs, Buffer *shstrtab, char *name,
+                               int type, int flags, int link, int info,
+                               int align, int entsize)
+{
+  Elf64_Shdr shdr = {};
+  int offset;
+  add_string(shstrtab, name, &offset);
+  shdr.sh_name = offset;
+  shdr.sh_type = type;
+  shdr.sh_flags = flags;
+  shdr.sh_link = link;
+  shdr.sh_info = info;
+  shdr.sh_addralign = align;
+  shdr.sh_entsize = entsize;
+  buf_push(shdrs, &shdr, sizeof(shdr));
+}
+
+// Place the contents of the `idx`-th section in the file.
+static void place_section(Buffer *out, Buffer *shdrs, int idx, Buffer *contents)
+{
+  Elf64_Shdr *shdr = (Elf64_Shdr *)shdrs->data + idx;
+  buf_align(out, shdr->sh_addralign ? shdr->sh_addralign : 1);
+  shdr->sh_offset = out->len;
+  shdr->sh_size = contents->len;
+  if (shdr->sh_type != SHT_NOBITS)
+    buf_push(out, contents->data, contents->len);
+}
+
+// Write the assembled code to `path` as an ELF relocatable object file.
+void write_object_file(char *path)
+{
+  if (!initialized)
+    init();
+
+  for (int i = 0; i < nsections; i++)
+  {
+    relax_branches(sections[i]);
+    resolve_fixups(sections[i]);
+  }
+
+  if (nrows && nfiles > 1 && files[1])
+  {
+    emit_debug_line();
+    emit_debug_info();
+  }
+
+  // Assign section header indices.
+  int shndx = 1;
+  for (int i = 0; i < nsections; i++)
+  {
+    sections[i]->shndx = shndx++;
+    if (count_relocations(sections[i]))
+      shndx++;
+  }
+  int symtab_shndx = shndx++;
+  int strtab_shndx = shndx++;
+  int shstrtab_shndx = shndx++;
+
+  // Symbol table. Local symbols come first.
+  Buffer symtab = {};
+  Buffer strtab = {};
+  buf_u8(&strtab, 0);
+  buf_zero(&symtab, sizeof(Elf64_Sym));
+  for (int i = 0; i < nsections; i++)
+    add_elf_symbol(&symtab, &strtab, sections[i]->sym, STB_LOCAL);
+  for (int i = 0; i < nsymbols; i++)
+    if (needs_symbol_entry(symbols[i]) && is_local_symbol(symbols[i]))
+      add_elf_symbol(&symtab, &strtab, symbols[i], STB_LOCAL);
+  int first_global = symtab.len / sizeof(Elf64_Sym);
+  for (int i = 0; i < nsymbols; i++)
+    if (needs_symbol_entry(symbols[i]) && !is_local_symbol(symbols[i]))
+      add_elf_symbol(&symtab, &strtab, symbols[i], STB_GLOBAL);
+
+  // Section headers and the contents
+  Buffer out = {};
+  Buffer shdrs = {};
+  Buffer shstrtab = {};
+  buf_u8(&shstrtab, 0);
+  buf_zero(&out, sizeof(Elf64_Ehdr));
+  buf_zero(&shdrs, sizeof(Elf64_Shdr));
+
+  for (int i = 0; i < nsections; i++)
+  {
+    Section *sec = sections[i];
+    add_section_header(&shdrs, &shstrtab, sec->name, sec->type, sec->flags,
+                       0, 0, sec->align, 0);
+    place_section(&out, &shdrs, sec->shndx, &sec->buf);
+
+    if (!count_relocations(sec))
+      continue;
+
+    // Relocations. References to .L labels are converted to
+    // references to section symbols, since .L labels are not
+    // in the symbol table.
+    Buffer rela = {};
+    for (int j = 0; j < sec->nfixups; j++)
+    {
+      Fixup *fx = sec->fixups[j];
+      if (fx->resolved)
+        continue;
+
+      Symbol *sym = fx->sym;
+      long addend = fx->addend;
+      if (!sym->is_section && is_local_label(sym->name) && !sym->keep)
+      {
+        addend += sym->offset;
+        sym = sym->sec->sym;
+      }
+
+      Elf64_Rela r = {};
+      r.r_offset = fx->offset;
+      r.r_info = ELF64_R_INFO(sym->index, fx->type);
+      r.r_addend = addend;
+      buf_push(&rela, &r, sizeof(r));
+    }
+
+    char *name = calloc(1, strlen(sec->name) + 6);
+    sprintf(name, ".rela%s", sec->name);
+    add_section_header(&shdrs, &shstrtab, name, SHT_RELA, SHF_INFO_LINK,
+                       symtab_shndx, sec->shndx, 8, sizeof(Elf64_Rela));
+    place_section(&out, &shdrs, sec->shndx + 1, &rela);
+    free(rela.data);
+  }
+
+  add_section_header(&shdrs, &shstrtab, ".symtab", SHT_SYMTAB, 0,
+                     strtab_shndx, first_global, 8, sizeof(Elf64_Sym));
+  place_section(&out, &shdrs, symtab_shndx, &symtab);
+  add_section_header(&shdrs, &shstrtab, ".strtab", SHT_STRTAB, 0, 0, 0, 1, 0);
+  place_section(&out, &shdrs, strtab_shndx, &strtab);
+  add_section_header(&shdrs, &shstrtab, ".shstrtab", SHT_STRTAB, 0, 0, 0, 1, 0);
+  place_section(&out, &shdrs, shstrtab_shndx, &shstrtab);
+
+  // Section header table
+  buf_align(&out, 8);
+  int shoff = out.len;
+  buf_push(&out, shdrs.data, shdrs.len);
+
+  // ELF header
+  Elf64_Ehdr *ehdr = (Elf64_Ehdr *)out.data;
+  memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+  ehdr->e_ident[EI_CLASS] = ELFCLASS64;
+  ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
+  ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+  ehdr->e_ident[EI_OSABI] = ELFOSABI_SYSV;
+  ehdr->e_type = ET_REL;
+  ehdr->e_machine = EM_RISCV;
+  ehdr->e_version = EV_CURRENT;
+  ehdr->e_flags = EF_RISCV_FLOAT_ABI_DOUBLE;
+  ehdr->e_ehsize = sizeof(Elf64_Ehdr);
+  ehdr->e_shentsize = sizeof(Elf64_Shdr);
+  ehdr->e_shnum = shstrtab_shndx + 1;
+  ehdr->e_shstrndx = shstrtab_shndx;
+  ehdr->e_shoff = shoff;
+
+  FILE *fp = fopen(path, "w");
+  if (!fp)
+    error("cannot open output file: %s: %s", path, strerror(errno));
+  if (fwrite(out.data, 1, out.len, fp) != out.len || fclose(fp))
+    error("cannot write output file: %s: %s", path, strerror(errno));
+}
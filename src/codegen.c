@@ -1,14 +1,18 @@
 #include "kiwicc.h"
+#include <pthread.h>
 
 /*********************************************
 * ...code generator...
 *********************************************/
 
-static int top;
-static int labelseq = 1;
-static int brkseq;
-static int contseq;
-static Function *current_fn;
+// Functions can be generated by multiple threads, so the state
+// of code generation is per thread.
+static _Thread_local int top;
+static _Thread_local int labelseq;
+static _Thread_local int brkseq;
+static _Thread_local int contseq;
+static _Thread_local Function *current_fn;
+static bool text_started;
 static char *argreg[] = {"a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7"};
 static int reg_save_area_offset[] = {-248/*a0*/, -240/*a1*/, -232/*a2*/, -224/*a3*/,
                                      -216/*a4*/, -208/*a5*/, -200/*a6*/, -192/*a7*/};
@@ -254,7 +258,18 @@ static void gen_addr(Node *node)
       gen_addi(reg(top++), "s0", -1 * var->offset);
       return;
     }
-    
+
+    // A thread-local variable is at a fixed offset from the thread
+    // pointer (the local-exec TLS model).
+    if (var->is_tls)
+    {
+      char *rd = reg(top++);
+      println("  lui %s, %%tprel_hi(%s)", rd, var->name);
+      println("  add %s, %s, tp, %%tprel_add(%s)", rd, rd, var->name);
+      println("  addi %s, %s, %%tprel_lo(%s)", rd, rd, var->name);
+      return;
+    }
+
     // TODO: handle "-fpic" option
     println("  la %s, %s", reg(top++), var->name);
 
@@ -316,7 +331,7 @@ static void builtin_va_start(Node *node)
 
 static void gen_expr(Node *node)
 {
-  println("  .loc %d %d", node->tok->file_no, node->tok->line_no);
+  println("  .loc %d %d", tok_file(node->tok)->file_no, node->tok->line_no);
   switch (node->kind)
   {
   case ND_NUM:
@@ -422,13 +437,13 @@ static void gen_expr(Node *node)
     int seq = labelseq++;
     gen_expr(node->cond);
     cmp_zero(node->cond->ty);
-    println("  bne %s, zero, .L.else.%d", reg(top), seq);
+    println("  bne %s, zero, .L.else.%s.%d", reg(top), current_fn->name, seq);
     gen_expr(node->then);
     top--;
-    println("  j .L.end.%d", seq);
-    println(".L.else.%d:", seq);
+    println("  j .L.end.%s.%d", current_fn->name, seq);
+    println(".L.else.%s.%d:", current_fn->name, seq);
     gen_expr(node->els);
-    println(".L.end.%d:", seq);
+    println(".L.end.%s.%d:", current_fn->name, seq);
     return;
   }
   case ND_NOT:
@@ -449,15 +464,15 @@ static void gen_expr(Node *node)
     int seq = labelseq++;
     gen_expr(node->lhs);
     cmp_zero(node->lhs->ty);
-    println("  bne %s, zero, .L.false.%d", reg(top), seq);
+    println("  bne %s, zero, .L.false.%s.%d", reg(top), current_fn->name, seq);
     gen_expr(node->rhs);
     cmp_zero(node->rhs->ty);
-    println("  bne %s, zero, .L.false.%d", reg(top), seq);
+    println("  bne %s, zero, .L.false.%s.%d", reg(top), current_fn->name, seq);
     println("  li %s, 1", reg(top));
-    println("  j .L.end.%d", seq);
-    println(".L.false.%d:", seq);
+    println("  j .L.end.%s.%d", current_fn->name, seq);
+    println(".L.false.%s.%d:", current_fn->name, seq);
     println("  mv %s, zero", reg(top++));
-    println("  .L.end.%d:", seq);
+    println("  .L.end.%s.%d:", current_fn->name, seq);
     return;
   }
   case ND_LOGOR:
@@ -465,15 +480,15 @@ static void gen_expr(Node *node)
     int seq = labelseq++;
     gen_expr(node->lhs);
     cmp_zero(node->lhs->ty);
-    println("  beq %s, zero, .L.true.%d", reg(top), seq);
+    println("  beq %s, zero, .L.true.%s.%d", reg(top), current_fn->name, seq);
     gen_expr(node->rhs);
     cmp_zero(node->rhs->ty);
-    println("  beq %s, zero, .L.true.%d", reg(top), seq);
+    println("  beq %s, zero, .L.true.%s.%d", reg(top), current_fn->name, seq);
     println("  mv %s, zero", reg(top));
-    println("  j .L.end.%d", seq);
-    println(".L.true.%d:", seq);
+    println("  j .L.end.%s.%d", current_fn->name, seq);
+    println(".L.true.%s.%d:", current_fn->name, seq);
     println("  li %s, 1", reg(top++));
-    println("  .L.end.%d:", seq);
+    println("  .L.end.%s.%d:", current_fn->name, seq);
     return;
   }
   case ND_FUNCALL:
@@ -705,7 +720,7 @@ static void gen_expr(Node *node)
 
 static void gen_stmt(Node *node)
 {
-  println("  .loc %d %d", node->tok->file_no, node->tok->line_no);
+  println("  .loc %d %d", tok_file(node->tok)->file_no, node->tok->line_no);
 
   switch (node->kind)
   {
@@ -716,20 +731,20 @@ static void gen_stmt(Node *node)
     {
       gen_expr(node->cond);
       cmp_zero(node->cond->ty);
-      println("  bne %s, zero, .L.else.%d", reg(top), seq);
+      println("  bne %s, zero, .L.else.%s.%d", reg(top), current_fn->name, seq);
       gen_stmt(node->then);
-      println("  jal zero, .L.end.%d", seq);
-      println(".L.else.%d:", seq);
+      println("  jal zero, .L.end.%s.%d", current_fn->name, seq);
+      println(".L.else.%s.%d:", current_fn->name, seq);
       gen_stmt(node->els);
-      println(".L.end.%d:", seq);
+      println(".L.end.%s.%d:", current_fn->name, seq);
     }
     else
     {
       gen_expr(node->cond);
       cmp_zero(node->cond->ty);
-      println("  bne %s, zero, .L.end.%d", reg(top), seq);
+      println("  bne %s, zero, .L.end.%s.%d", reg(top), current_fn->name, seq);
       gen_stmt(node->then);
-      println(".L.end.%d:", seq);
+      println(".L.end.%s.%d:", current_fn->name, seq);
     }
     return;
   }
@@ -740,14 +755,14 @@ static void gen_stmt(Node *node)
     int cont = contseq;
     brkseq = contseq = seq;
 
-    println(".L.begin.%d:", seq);
+    println(".L.begin.%s.%d:", current_fn->name, seq);
     gen_expr(node->cond);
-    println("  beq %s, zero, .L.break.%d", reg(--top), seq);
+    println("  beq %s, zero, .L.break.%s.%d", reg(--top), current_fn->name, seq);
     if (node->then)
       gen_stmt(node->then);
-    println(".L.continue.%d:", seq);
-    println("  jal zero, .L.begin.%d", seq);
-    println(".L.break.%d:", seq);
+    println(".L.continue.%s.%d:", current_fn->name, seq);
+    println("  jal zero, .L.begin.%s.%d", current_fn->name, seq);
+    println(".L.break.%s.%d:", current_fn->name, seq);
 
     brkseq = brk;
     contseq = cont;
@@ -760,13 +775,13 @@ static void gen_stmt(Node *node)
     int cont = contseq;
     brkseq = contseq = seq;
 
-    println(".L.begin.%d:", seq);
+    println(".L.begin.%s.%d:", current_fn->name, seq);
     gen_stmt(node->then);
-    println(".L.continue.%d:", seq);
+    println(".L.continue.%s.%d:", current_fn->name, seq);
     gen_expr(node->cond);
     cmp_zero(node->cond->ty);
-    println("  beq %s, zero, .L.begin.%d", reg(top), seq);
-    println(".L.break.%d:", seq);
+    println("  beq %s, zero, .L.begin.%s.%d", reg(top), current_fn->name, seq);
+    println(".L.break.%s.%d:", current_fn->name, seq);
 
     brkseq = brk;
     contseq = cont;
@@ -783,25 +798,25 @@ static void gen_stmt(Node *node)
     if (node->init)
       gen_stmt(node->init);
     println("# for init end");
-    println(".L.begin.%d:", seq);
+    println(".L.begin.%s.%d:", current_fn->name, seq);
     if (node->cond)
     {
       println("# for cond start");
       gen_expr(node->cond);
       println("# for cond end");
-      println("  beq %s, zero, .L.break.%d", reg(--top), seq);
+      println("  beq %s, zero, .L.break.%s.%d", reg(--top), current_fn->name, seq);
     }
     println("# for then start");
     if (node->then)
       gen_stmt(node->then);
     println("# for then end");
-    println(".L.continue.%d:", seq);
+    println(".L.continue.%s.%d:", current_fn->name, seq);
     println("# for inc start");
     if (node->inc)
       gen_stmt(node->inc);
     println("# for inc end");
-    println("  jal zero, .L.begin.%d", seq);
-    println(".L.break.%d:", seq);
+    println("  jal zero, .L.begin.%s.%d", current_fn->name, seq);
+    println(".L.break.%s.%d:", current_fn->name, seq);
 
     brkseq = brk;
     contseq = cont;
@@ -820,7 +835,7 @@ static void gen_stmt(Node *node)
     {
       n->case_label = labelseq++;
       println("  li a0, %d", n->val);
-      println("  beq a0, %s, .L.case.%d", reg(top - 1), n->case_label);
+      println("  beq a0, %s, .L.case.%s.%d", reg(top - 1), current_fn->name, n->case_label);
     }
     top--;
 
@@ -828,18 +843,18 @@ static void gen_stmt(Node *node)
     {
       int i = labelseq++;
       node->default_case->case_label = i;
-      println("  j .L.case.%d", i);
+      println("  j .L.case.%s.%d", current_fn->name, i);
     }
 
-    println("  j .L.break.%d", seq);
+    println("  j .L.break.%s.%d", current_fn->name, seq);
     gen_stmt(node->then);
-    println(".L.break.%d:", seq);
+    println(".L.break.%s.%d:", current_fn->name, seq);
 
     brkseq = brk;
     return;
   }
   case ND_CASE:
-    println(".L.case.%d:", node->case_label);
+    println(".L.case.%s.%d:", current_fn->name, node->case_label);
     gen_stmt(node->lhs);
     return;
   case ND_BLOCK:
@@ -851,12 +866,12 @@ static void gen_stmt(Node *node)
   case ND_BREAK:
     if (brkseq == 0)
       error_tok(node->tok, "stray break");
-    println("  j .L.break.%d", brkseq);
+    println("  j .L.break.%s.%d", current_fn->name, brkseq);
     return;
   case ND_CONTINUE:
     if (contseq == 0)
       error_tok(node->tok, "stray continue");
-    println("  j .L.continue.%d", contseq);
+    println("  j .L.continue.%s.%d", current_fn->name, contseq);
     return;
   case ND_GOTO:
     println("  j .L.label.%s.%s", current_fn->name, node->label_name);
@@ -899,23 +914,45 @@ static int int_log2(int x) {
   return (v == x) ? i : -1;
 }
 
+static void emit_var_label(Var *var)
+{
+  int align = int_log2(var->align);
+  if (align == -1)
+    error_tok(var->tok, "requested alignment is not a positive power of 2");
+  println("  .align %d", align);
+  if (!var->is_static)
+    println("  .globl %s", var->name);
+  println("%s:", var->name);
+}
+
+static void emit_var_data(Var *var)
+{
+  emit_var_label(var);
+  Relocation *rel = var->rel;
+  int pos = 0;
+  while (pos < var->ty->size)
+  {
+    if (rel && rel->offset == pos)
+    {
+      println("  .quad %s%+ld", rel->label, rel->addend);
+      rel = rel->next;
+      pos += 8;
+    }
+    else
+      println("  .byte %d", var->init_data[pos++]);
+  }
+}
+
 static void emit_bss(Program *prog)
 {
   println(".bss");
   for (VarList *vl = prog->globals; vl; vl = vl->next)
   {
     Var *var = vl->var;
-
-    if (var->init_data)
+    if (var->init_data || var->is_tls)
       continue;
 
-    int align = int_log2(var->align);
-    if (align == -1)
-      error_tok(var->tok, "requested alignment is not a positive power of 2");
-    println("  .align %d", align);
-    if (!var->is_static)
-      println("  .globl %s", var->name);
-    println("%s:", var->name);
+    emit_var_label(var);
     println("  .zero %d", size_of(var->ty));
   }
 }
@@ -926,172 +963,386 @@ static void emit_data(Program *prog)
   for (VarList *vl = prog->globals; vl; vl = vl->next)
   {
     Var *var = vl->var;
-    if (!var->init_data)
+    if (!var->init_data || var->is_literal || var->is_tls)
       continue;
+    emit_var_data(var);
+  }
+}
 
-    int align = int_log2(var->align);
-    if (align == -1)
-      error_tok(var->tok, "requested alignment is not a positive power of 2");
-    println("  .align %d", align);
-    if (!var->is_static)
-      println("  .globl %s", var->name);
-    println("%s:", var->name);
-    Relocation *rel = var->rel;
-    int pos = 0;
-    while (pos < var->ty->size)
+// Thread-local variables go to .tdata and .tbss, which are the
+// initial image of each thread's copy.
+static void emit_tls(Program *prog)
+{
+  bool started = false;
+  for (VarList *vl = prog->globals; vl; vl = vl->next)
+  {
+    Var *var = vl->var;
+    if (!var->is_tls || !var->init_data)
+      continue;
+
+    if (!started)
     {
-      if (rel && rel->offset == pos)
-      {
-        println("  .quad %s%+ld", rel->label, rel->addend);
-        rel = rel->next;
-        pos += 8;
-      }
-      else
-        println("  .byte %d", var->init_data[pos++]);
+      println(".section .tdata,\"awT\",@progbits");
+      started = true;
+    }
+    emit_var_data(var);
+  }
+
+  started = false;
+  for (VarList *vl = prog->globals; vl; vl = vl->next)
+  {
+    Var *var = vl->var;
+    if (!var->is_tls || var->init_data)
+      continue;
+
+    if (!started)
+    {
+      println(".section .tbss,\"awT\",@nobits");
+      started = true;
     }
+    emit_var_label(var);
+    println("  .zero %d", size_of(var->ty));
   }
 }
 
-static void emit_text(Program *prog)
+// Emit `len` bytes at `p` as a .string directive, or as .ascii if
+// they are not a string terminated by the only '\0'.
+static void emit_string(char *p, int len)
 {
-  println(".text");
-  for (Function *fn = prog->fns; fn; fn = fn->next)
+  bool is_string = len > 0 && !p[len - 1] && !memchr(p, '\0', len - 1);
+  if (is_string)
+    len--;
+
+  // Each byte takes at most 4 characters.
+  char *buf = malloc(len * 4 + 1);
+  char *q = buf;
+  for (int i = 0; i < len; i++)
   {
-    current_fn = fn;
-    if (!fn->is_static)
-      println(".global %s", fn->name);
-    println("%s:", fn->name);
-
-    // Prologue. s0 ~ s11 and fs0 ~ fs11 are callee-saved registers.
-    // For frame pointer
-    println("  addi sp, sp, -8");
-    // Save frame pointer
-    println("  sd s0, (sp)");
-
-    println("  mv s0, sp");
-    gen_addi("sp", "sp", -1 * fn->stack_size);
-    println("  sd s1, -8(s0)");
-    println("  sd s2, -16(s0)");
-    println("  sd s3, -24(s0)");
-    println("  sd s4, -32(s0)");
-    println("  sd s5, -40(s0)");
-    println("  sd s6, -48(s0)");
-    println("  sd s7, -56(s0)");
-    println("  sd s8, -64(s0)");
-    println("  sd s9, -72(s0)");
-    println("  sd s10, -80(s0)");
-    println("  sd s11, -88(s0)");
-
-    println("  fsd fs0, -96(s0)");
-    println("  fsd fs1, -104(s0)");
-    println("  fsd fs2, -112(s0)");
-    println("  fsd fs3, -120(s0)");
-    println("  fsd fs4, -128(s0)");
-    println("  fsd fs5, -136(s0)");
-    println("  fsd fs6, -144(s0)");
-    println("  fsd fs7, -152(s0)");
-    println("  fsd fs8, -160(s0)");
-    println("  fsd fs9, -168(s0)");
-    println("  fsd fs10, -176(s0)");
-    println("  fsd fs11, -184(s0)");
-
-    // Save arg registers to the register save area
-    // if the function is the variadic
-    if (fn->is_variadic)
+    unsigned char c = p[i];
+    if (c == '"' || c == '\\')
     {
-      println("  sd a0, %d(s0)", reg_save_area_offset[0]);
-      println("  sd a1, %d(s0)", reg_save_area_offset[1]);
-      println("  sd a2, %d(s0)", reg_save_area_offset[2]);
-      println("  sd a3, %d(s0)", reg_save_area_offset[3]);
-      println("  sd a4, %d(s0)", reg_save_area_offset[4]);
-      println("  sd a5, %d(s0)", reg_save_area_offset[5]);
-      println("  sd a6, %d(s0)", reg_save_area_offset[6]);
-      println("  sd a7, %d(s0)", reg_save_area_offset[7]);
+      *q++ = '\\';
+      *q++ = c;
     }
+    else if (c < ' ' || c >= 127)
+    {
+      *q++ = '\\';
+      *q++ = '0' + (c >> 6);
+      *q++ = '0' + ((c >> 3) & 7);
+      *q++ = '0' + (c & 7);
+    }
+    else
+      *q++ = c;
+  }
+  *q = '\0';
 
-    // Save arguments to the stack
+  println("  %s \"%s\"", is_string ? ".string" : ".ascii", buf);
+  free(buf);
+}
 
-    // g stands for general purpose registers.
-    // f stands for floating point registers
-    int gp = 0, fp = 0;
-    for (VarList *param = fn->params; param; param = param->next)
-      if (is_flonum(param->var->ty))
-        fp++;
-      else
-        gp++;
-    for (VarList *param = fn->params; param; param = param->next)
+// String literals are read-only, so they are put in .rodata
+// as strings instead of a byte at a time.
+static void emit_rodata(Program *prog)
+{
+  bool started = false;
+  for (VarList *vl = prog->globals; vl; vl = vl->next)
+  {
+    Var *var = vl->var;
+    if (!var->is_literal)
+      continue;
+
+    if (!started)
     {
-      Var *var = param->var;
-      if (var->ty->kind == TY_FLOAT)
-        gen_offset_instr("fsw", fargreg[--fp], "s0", -1 * var->offset);
-      else if (var->ty->kind == TY_DOUBLE)
-        gen_offset_instr("fsd", fargreg[--fp], "s0", -1 * var->offset);
-      else
-      {
-        int sz = size_of(var->ty);
-        if (sz == 1)
-          gen_offset_instr("sb", argreg[--gp], "s0", -1 * var->offset);
-        else if (sz == 2)
-          gen_offset_instr("sh", argreg[--gp], "s0", -1 * var->offset);
-        else if (sz == 4)
-          gen_offset_instr("sw", argreg[--gp], "s0", -1 * var->offset);
-        else
-          gen_offset_instr("sd", argreg[--gp], "s0", -1 * var->offset);
-      }
+      println(".section .rodata");
+      started = true;
     }
+    println("%s:", var->name);
+    emit_string(var->init_data, var->ty->size);
+  }
+}
+
+// Assign offsets to local variables.
+static void assign_lvar_offsets(Function *fn)
+{
+  // Besides local variables, callee-saved registers take 23 bytes
+  // and the variable-argument save takes 31 bytes in the stack.
+  int offset = fn->is_variadic ? 248 : 184;
+
+  for (VarList *vl = fn->locals; vl; vl = vl->next)
+  {
+    offset = align_to(offset, vl->var->align);
+    offset += size_of(vl->var->ty);
+    vl->var->offset = offset;
+  }
+  fn->stack_size = align_to(offset, 16);
+}
 
-    // Generate statements
-    for (Node *node = fn->node; node; node = node->next)
+static void emit_function(Function *fn)
+{
+  current_fn = fn;
+  labelseq = 1;
+  assign_lvar_offsets(fn);
+
+  if (!fn->is_static)
+    println(".global %s", fn->name);
+  println("%s:", fn->name);
+
+  // Prologue. s0 ~ s11 and fs0 ~ fs11 are callee-saved registers.
+  // For frame pointer
+  println("  addi sp, sp, -8");
+  // Save frame pointer
+  println("  sd s0, (sp)");
+
+  println("  mv s0, sp");
+  gen_addi("sp", "sp", -1 * fn->stack_size);
+  println("  sd s1, -8(s0)");
+  println("  sd s2, -16(s0)");
+  println("  sd s3, -24(s0)");
+  println("  sd s4, -32(s0)");
+  println("  sd s5, -40(s0)");
+  println("  sd s6, -48(s0)");
+  println("  sd s7, -56(s0)");
+  println("  sd s8, -64(s0)");
+  println("  sd s9, -72(s0)");
+  println("  sd s10, -80(s0)");
+  println("  sd s11, -88(s0)");
+
+  println("  fsd fs0, -96(s0)");
+  println("  fsd fs1, -104(s0)");
+  println("  fsd fs2, -112(s0)");
+  println("  fsd fs3, -120(s0)");
+  println("  fsd fs4, -128(s0)");
+  println("  fsd fs5, -136(s0)");
+  println("  fsd fs6, -144(s0)");
+  println("  fsd fs7, -152(s0)");
+  println("  fsd fs8, -160(s0)");
+  println("  fsd fs9, -168(s0)");
+  println("  fsd fs10, -176(s0)");
+  println("  fsd fs11, -184(s0)");
+
+  // Save arg registers to the register save area
+  // if the function is the variadic
+  if (fn->is_variadic)
+  {
+    println("  sd a0, %d(s0)", reg_save_area_offset[0]);
+    println("  sd a1, %d(s0)", reg_save_area_offset[1]);
+    println("  sd a2, %d(s0)", reg_save_area_offset[2]);
+    println("  sd a3, %d(s0)", reg_save_area_offset[3]);
+    println("  sd a4, %d(s0)", reg_save_area_offset[4]);
+    println("  sd a5, %d(s0)", reg_save_area_offset[5]);
+    println("  sd a6, %d(s0)", reg_save_area_offset[6]);
+    println("  sd a7, %d(s0)", reg_save_area_offset[7]);
+  }
+
+  // Save arguments to the stack
+
+  // g stands for general purpose registers.
+  // f stands for floating point registers
+  int gp = 0, fp = 0;
+  for (VarList *param = fn->params; param; param = param->next)
+    if (is_flonum(param->var->ty))
+      fp++;
+    else
+      gp++;
+  for (VarList *param = fn->params; param; param = param->next)
+  {
+    Var *var = param->var;
+    if (var->ty->kind == TY_FLOAT)
+      gen_offset_instr("fsw", fargreg[--fp], "s0", -1 * var->offset);
+    else if (var->ty->kind == TY_DOUBLE)
+      gen_offset_instr("fsd", fargreg[--fp], "s0", -1 * var->offset);
+    else
     {
-      gen_stmt(node);
-      assert(top == 0);
+      int sz = size_of(var->ty);
+      if (sz == 1)
+        gen_offset_instr("sb", argreg[--gp], "s0", -1 * var->offset);
+      else if (sz == 2)
+        gen_offset_instr("sh", argreg[--gp], "s0", -1 * var->offset);
+      else if (sz == 4)
+        gen_offset_instr("sw", argreg[--gp], "s0", -1 * var->offset);
+      else
+        gen_offset_instr("sd", argreg[--gp], "s0", -1 * var->offset);
     }
+  }
 
-    // Epilogue
-    // Restore the values of sp, s0 ~ s11
-    println(".L.return.%s:", fn->name);
-  
-    println("  ld s1, -8(s0)");
-    println("  ld s2, -16(s0)");
-    println("  ld s3, -24(s0)");
-    println("  ld s4, -32(s0)");
-    println("  ld s5, -40(s0)");
-    println("  ld s6, -48(s0)");
-    println("  ld s7, -56(s0)");
-    println("  ld s8, -64(s0)");
-    println("  ld s9, -72(s0)");
-    println("  ld s10, -80(s0)");
-    println("  ld s11, -88(s0)");
-
-    println("  fld fs0, -96(s0)");
-    println("  fld fs1, -104(s0)");
-    println("  fld fs2, -112(s0)");
-    println("  fld fs3, -120(s0)");
-    println("  fld fs4, -128(s0)");
-    println("  fld fs5, -136(s0)");
-    println("  fld fs6, -144(s0)");
-    println("  fld fs7, -152(s0)");
-    println("  fld fs8, -160(s0)");
-    println("  fld fs9, -168(s0)");
-    println("  fld fs10, -176(s0)");
-    println("  fld fs11, -184(s0)");
-  
-    println("  mv sp, s0");
-    println("  ld s0, (sp)");
-    println("  addi sp, sp, 8");
-    println("  ret");
+  // Generate statements
+  for (Node *node = fn->node; node; node = node->next)
+  {
+    gen_stmt(node);
+    assert(top == 0);
   }
+
+  // Epilogue
+  // Restore the values of sp, s0 ~ s11
+  println(".L.return.%s:", fn->name);
+
+  println("  ld s1, -8(s0)");
+  println("  ld s2, -16(s0)");
+  println("  ld s3, -24(s0)");
+  println("  ld s4, -32(s0)");
+  println("  ld s5, -40(s0)");
+  println("  ld s6, -48(s0)");
+  println("  ld s7, -56(s0)");
+  println("  ld s8, -64(s0)");
+  println("  ld s9, -72(s0)");
+  println("  ld s10, -80(s0)");
+  println("  ld s11, -88(s0)");
+
+  println("  fld fs0, -96(s0)");
+  println("  fld fs1, -104(s0)");
+  println("  fld fs2, -112(s0)");
+  println("  fld fs3, -120(s0)");
+  println("  fld fs4, -128(s0)");
+  println("  fld fs5, -136(s0)");
+  println("  fld fs6, -144(s0)");
+  println("  fld fs7, -152(s0)");
+  println("  fld fs8, -160(s0)");
+  println("  fld fs9, -168(s0)");
+  println("  fld fs10, -176(s0)");
+  println("  fld fs11, -184(s0)");
+
+  println("  mv sp, s0");
+  println("  ld s0, (sp)");
+  println("  addi sp, sp, 8");
+  println("  ret");
 }
 
-void codegen(Program *prog)
+/*** Parallel code generation ***/
+
+// With -fcodegen-threads=N, functions are generated by N threads.
+// Each function is written to its own buffer, and the buffers are
+// appended to the output in the source order.
+
+static Function **par_fns;
+static AsmBuf **par_bufs;
+static bool *par_done;
+static int par_nfns;
+static int par_next;
+static pthread_mutex_t par_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t par_cond = PTHREAD_COND_INITIALIZER;
+
+static void *codegen_worker(void *arg)
 {
-  // Output the assembly code.
+  for (;;)
+  {
+    pthread_mutex_lock(&par_mutex);
+    int i = par_next++;
+    pthread_mutex_unlock(&par_mutex);
+    if (i >= par_nfns)
+      return NULL;
+
+    emit_set_buf(par_bufs[i]);
+    emit_function(par_fns[i]);
+
+    pthread_mutex_lock(&par_mutex);
+    par_done[i] = true;
+    pthread_cond_broadcast(&par_cond);
+    pthread_mutex_unlock(&par_mutex);
+  }
+}
+
+static void emit_functions_parallel(Function *fns)
+{
+  par_nfns = 0;
+  for (Function *fn = fns; fn; fn = fn->next)
+    par_nfns++;
+
+  par_fns = calloc(par_nfns, sizeof(Function *));
+  par_bufs = calloc(par_nfns, sizeof(AsmBuf *));
+  par_done = calloc(par_nfns, sizeof(bool));
+  par_next = 0;
+
+  int i = 0;
+  for (Function *fn = fns; fn; fn = fn->next)
+  {
+    par_fns[i] = fn;
+    par_bufs[i] = emit_new_buf();
+    i++;
+  }
+
+  int nthreads = opt_codegen_threads < par_nfns ? opt_codegen_threads : par_nfns;
+  pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+  for (int i = 0; i < nthreads; i++)
+    if (pthread_create(&threads[i], NULL, codegen_worker, NULL))
+      error("cannot create a thread");
+
+  // Take the functions in order as they get done.
+  for (int i = 0; i < par_nfns; i++)
+  {
+    pthread_mutex_lock(&par_mutex);
+    while (!par_done[i])
+      pthread_cond_wait(&par_cond, &par_mutex);
+    pthread_mutex_unlock(&par_mutex);
+
+    emit_append_buf(par_bufs[i]);
+    emit_sync();
+  }
+
+  for (int i = 0; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+  free(threads);
+  free(par_fns);
+  free(par_bufs);
+  free(par_done);
+}
+
+static void emit_text(Program *prog)
+{
+  println(".text");
+  if (opt_codegen_threads > 1)
+  {
+    emit_functions_parallel(prog->fns);
+    return;
+  }
+
+  for (Function *fn = prog->fns; fn; fn = fn->next)
+  {
+    emit_function(fn);
 
+    // Let the output go while we generate the next function.
+    emit_sync();
+  }
+}
+
+static void emit_globals(Program *prog)
+{
   char **paths = get_input_files();
   for (int i = 0; paths[i]; i++)
     println(".file %d \"%s\"", i + 1, paths[i]);
 
   emit_bss(prog);
   emit_data(prog);
+  emit_tls(prog);
+  emit_rodata(prog);
+}
+
+void codegen(Program *prog)
+{
+  // Output the assembly code.
+  emit_globals(prog);
   emit_text(prog);
 }
+
+// In the streaming mode, each function is generated as soon as it is
+// parsed. The globals are known only at the end, so they are put in
+// front of the functions by codegen_end(). The output is the same
+// as codegen().
+void codegen_function(Function *fn)
+{
+  if (!text_started)
+  {
+    println(".text");
+    text_started = true;
+  }
+  emit_function(fn);
+}
+
+void codegen_end(Program *prog)
+{
+  if (!text_started)
+    println(".text");
+
+  emit_begin_front();
+  emit_globals(prog);
+  emit_end_front();
+}
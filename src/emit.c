@@ -0,0 +1,366 @@
+#include "kiwicc.h"
+#include <sys/uio.h>
+
+/*********************************************
+* ...assembly emitter...
+*********************************************/
+
+// The assembly text is built in memory and written out at once by
+// emit_flush(). The buffer is a list of chunks so that growing it
+// never copies the text we have already written, and a line never
+// spans two chunks.
+//
+// If the built-in assembler is used, each line is handed to it as
+// soon as it is formatted, and the buffer space is reused.
+//
+// Lines emitted between emit_begin_front() and emit_end_front()
+// are kept in another list, which is written before the others.
+//
+// Functions generated by codegen threads are written to their own
+// buffers, which are appended to the main one in order.
+
+#define CHUNK_SIZE (64 * 1024)
+
+// The first chunk of a buffer is small since there can be
+// a buffer per function.
+#define FIRST_CHUNK_SIZE 4096
+
+typedef struct Chunk Chunk;
+struct Chunk
+{
+  Chunk *next;
+  int len;
+  int cap;
+  char *buf;
+};
+
+struct AsmBuf
+{
+  Chunk *head;
+  Chunk *tail;
+  int line_start; // Start of the current line in `tail`
+};
+
+static AsmBuf main_buf;
+static AsmBuf front_buf;
+
+// The buffer println() writes to. Each thread has its own.
+static _Thread_local AsmBuf *cur = &main_buf;
+
+static bool to_assembler;
+static int stream_fd = -1;
+
+static Chunk *new_chunk(int cap)
+{
+  Chunk *c = calloc(1, sizeof(Chunk));
+  c->cap = cap;
+  c->buf = malloc(cap);
+  return c;
+}
+
+// Make room for `n` more bytes in the current line.
+static char *reserve(int n)
+{
+  Chunk *tail = cur->tail;
+  if (tail && tail->len + n <= tail->cap)
+    return tail->buf + tail->len;
+
+  // Move the current line to a new chunk.
+  int len = tail ? tail->len - cur->line_start : 0;
+  int cap = tail ? CHUNK_SIZE : FIRST_CHUNK_SIZE;
+  while (cap < (len + n) * 2)
+    cap *= 2;
+
+  Chunk *c = new_chunk(cap);
+  if (tail)
+  {
+    memcpy(c->buf, tail->buf + cur->line_start, len);
+    tail->len = cur->line_start;
+    tail->next = c;
+  }
+  else
+    cur->head = c;
+  c->len = len;
+  cur->tail = c;
+  cur->line_start = 0;
+  return c->buf + c->len;
+}
+
+static void emit_str(char *s, int len)
+{
+  memcpy(reserve(len), s, len);
+  cur->tail->len += len;
+}
+
+static void emit_char(char c)
+{
+  *reserve(1) = c;
+  cur->tail->len++;
+}
+
+static void emit_ulong(unsigned long val)
+{
+  char buf[24];
+  char *p = buf + sizeof(buf);
+  do
+  {
+    *--p = '0' + val % 10;
+    val = val / 10;
+  } while (val);
+  emit_str(p, buf + sizeof(buf) - p);
+}
+
+static void emit_long(long val, bool plus)
+{
+  if (val < 0)
+  {
+    emit_char('-');
+    emit_ulong(-(unsigned long)val);
+    return;
+  }
+  if (plus)
+    emit_char('+');
+  emit_ulong(val);
+}
+
+// Append a line of assembly. This supports only a subset of printf()
+// conversions, that is, %s, %c, %d, %u, %x and %%, with an optional "l"
+// length modifier and an optional "+" flag.
+void println(char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+
+  for (char *p = fmt; *p;)
+  {
+    char *q = p;
+    while (*q && *q != '%')
+      q++;
+    if (q != p)
+      emit_str(p, q - p);
+    if (!*q)
+      break;
+
+    p = q + 1;
+    bool plus = false;
+    bool is_long = false;
+    if (*p == '+')
+    {
+      plus = true;
+      p++;
+    }
+    while (*p == 'l')
+    {
+      is_long = true;
+      p++;
+    }
+
+    switch (*p++)
+    {
+    case 's':
+    {
+      char *s = va_arg(ap, char *);
+      emit_str(s, strlen(s));
+      break;
+    }
+    case 'c':
+      emit_char(va_arg(ap, int));
+      break;
+    case 'd':
+    case 'i':
+      emit_long(is_long ? va_arg(ap, long) : va_arg(ap, int), plus);
+      break;
+    case 'u':
+      emit_ulong(is_long ? va_arg(ap, unsigned long) : va_arg(ap, unsigned int));
+      break;
+    case 'x':
+    {
+      unsigned long val = is_long ? va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
+      char buf[16];
+      int i = sizeof(buf);
+      do
+      {
+        buf[--i] = "0123456789abcdef"[val % 16];
+        val = val / 16;
+      } while (val);
+      emit_str(buf + i, sizeof(buf) - i);
+      break;
+    }
+    case '%':
+      emit_char('%');
+      break;
+    default:
+      error("internal error: unsupported format: %s", fmt);
+    }
+  }
+  va_end(ap);
+
+  if (to_assembler && cur == &main_buf)
+  {
+    emit_char('\0');
+    assemble_line(cur->tail->buf + cur->line_start);
+    cur->tail->len = cur->line_start;
+    return;
+  }
+
+  emit_char('\n');
+  cur->line_start = cur->tail->len;
+}
+
+// Hand each line to the built-in assembler instead of buffering it.
+void emit_to_assembler()
+{
+  to_assembler = true;
+}
+
+void emit_begin_front()
+{
+  cur = &front_buf;
+}
+
+void emit_end_front()
+{
+  cur = &main_buf;
+}
+
+AsmBuf *emit_new_buf()
+{
+  return calloc(1, sizeof(AsmBuf));
+}
+
+// Let println() of this thread write to `buf`.
+void emit_set_buf(AsmBuf *buf)
+{
+  cur = buf;
+}
+
+// Write the text to `fd` every time a function is generated,
+// instead of keeping all of it until the end.
+void emit_stream_to(int fd)
+{
+  stream_fd = fd;
+}
+
+// Called at the end of each function.
+void emit_sync()
+{
+  if (stream_fd != -1)
+    emit_flush(stream_fd);
+}
+
+static void write_chunks(int fd, Chunk *c)
+{
+  struct iovec iov[64];
+
+  while (c)
+  {
+    int n = 0;
+    for (; c && n < sizeof(iov) / sizeof(*iov); c = c->next)
+    {
+      if (!c->len)
+        continue;
+      iov[n].iov_base = c->buf;
+      iov[n].iov_len = c->len;
+      n++;
+    }
+
+    // writev() may write fewer bytes than requested.
+    int i = 0;
+    while (i < n)
+    {
+      long w = writev(fd, iov + i, n - i);
+      if (w < 0)
+      {
+        if (errno == EINTR)
+          continue;
+        error("cannot write output: %s", strerror(errno));
+      }
+      while (i < n && w >= iov[i].iov_len)
+        w -= iov[i++].iov_len;
+      if (i < n)
+      {
+        iov[i].iov_base = (char *)iov[i].iov_base + w;
+        iov[i].iov_len -= w;
+      }
+    }
+  }
+}
+
+static void free_chunks(Chunk *c)
+{
+  while (c)
+  {
+    Chunk *next = c->next;
+    free(c->buf);
+    free(c);
+    c = next;
+  }
+}
+
+// Empty the buffers, keeping the first chunk for reuse.
+static void reset()
+{
+  free_chunks(front_buf.head);
+  front_buf.head = front_buf.tail = NULL;
+  front_buf.line_start = 0;
+
+  if (!main_buf.head)
+    return;
+  free_chunks(main_buf.head->next);
+  main_buf.head->next = NULL;
+  main_buf.head->len = 0;
+  main_buf.tail = main_buf.head;
+  main_buf.line_start = 0;
+}
+
+// Write the buffered assembly text to `fd`.
+void emit_flush(int fd)
+{
+  write_chunks(fd, front_buf.head);
+  write_chunks(fd, main_buf.head);
+  reset();
+}
+
+static void assemble_chunks(Chunk *c)
+{
+  for (; c; c = c->next)
+  {
+    char *p = c->buf;
+    char *end = c->buf + c->len;
+    while (p < end)
+    {
+      char *q = memchr(p, '\n', end - p);
+      *q = '\0';
+      assemble_line(p);
+      p = q + 1;
+    }
+  }
+}
+
+// Hand the buffered assembly text to the built-in assembler.
+void emit_assemble()
+{
+  assemble_chunks(front_buf.head);
+  assemble_chunks(main_buf.head);
+  reset();
+}
+
+// Append the text in `buf` to the main buffer and free `buf`.
+void emit_append_buf(AsmBuf *buf)
+{
+  if (to_assembler)
+  {
+    assemble_chunks(buf->head);
+    free_chunks(buf->head);
+  }
+  else if (buf->head)
+  {
+    if (main_buf.tail)
+      main_buf.tail->next = buf->head;
+    else
+      main_buf.head = buf->head;
+    main_buf.tail = buf->tail;
+    main_buf.line_start = buf->tail->len;
+  }
+  free(buf);
+}
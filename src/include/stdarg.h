@@ -5,6 +5,10 @@ typedef void * va_list;
 
 typedef va_list __builtin_va_list;
 #define va_start(ap, param) __builtin_va_start(ap, param)
+#define va_end(ap) ((void)(ap))
+
+// Each argument takes an 8-byte slot in the register save area.
+#define va_arg(ap, ty) ({ ty *__va_p = (ty *)(ap); (ap) = (char *)(ap) + 8; *__va_p; })
 typedef __builtin_va_list __gnuc_va_list;
 
 #endif /* __STDARG_H */
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -11,6 +12,8 @@
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <libgen.h>
+#include <signal.h>
+#include <spawn.h>
 #include <unistd.h>
 
 #define PATHNAME_SIZE 512
@@ -26,37 +29,137 @@ typedef struct Relocation Relocation;
 
 typedef enum
 {
-  TK_RESERVED, // Keywords or punctuators
+  TK_RESERVED, // Punctuators
   TK_IDENT,    // Identifier
   TK_STR,      // String literrals
   TK_NUM,      // Integer literals
   TK_EOF,      // End-of-file markers
+  TK_LAZY,     // Rest of a source file, not tokenized yet
+
+  // Each keyword has its own kind. Identifiers are converted to
+  // keywords by convert_keywords() after preprocessing.
+  TK_KW_RETURN,
+  TK_KW_IF,
+  TK_KW_ELSE,
+  TK_KW_WHILE,
+  TK_KW_DO,
+  TK_KW_FOR,
+  TK_KW_SIZEOF,
+  TK_KW_GOTO,
+  TK_KW_BREAK,
+  TK_KW_CONTINUE,
+  TK_KW_SWITCH,
+  TK_KW_CASE,
+  TK_KW_DEFAULT,
+  TK_KW_ALIGNOF,
+  TK_KW_RESTRICT,
+
+  // Keywords that start a declaration. Keep them between
+  // TK_KW_VOID and TK_KW_DOUBLE.
+  TK_KW_VOID,
+  TK_KW_BOOL,
+  TK_KW_CHAR,
+  TK_KW_SHORT,
+  TK_KW_INT,
+  TK_KW_LONG,
+  TK_KW_STRUCT,
+  TK_KW_UNION,
+  TK_KW_TYPEDEF,
+  TK_KW_ENUM,
+  TK_KW_STATIC,
+  TK_KW_EXTERN,
+  TK_KW_ALIGNAS,
+  TK_KW_SIGNED,
+  TK_KW_UNSIGNED,
+  TK_KW_CONST,
+  TK_KW_VOLATILE,
+  TK_KW_REGISTER,
+  TK_KW_NORETURN,
+  TK_KW_INLINE,
+  TK_KW_THREAD_LOCAL,
+  TK_KW_FLOAT,
+  TK_KW_DOUBLE,
 } TokenKind;
 
-// Token type
-typedef struct Token Token;
-struct Token
+// Punctuators of two or more characters. A single-character
+// punctuator is identified by the character itself.
+typedef enum
+{
+  PUNCT_EQ = 128,   // ==
+  PUNCT_NE,         // !=
+  PUNCT_LE,         // <=
+  PUNCT_GE,         // >=
+  PUNCT_ARROW,      // ->
+  PUNCT_ADD_ASSIGN, // +=
+  PUNCT_SUB_ASSIGN, // -=
+  PUNCT_MUL_ASSIGN, // *=
+  PUNCT_DIV_ASSIGN, // /=
+  PUNCT_MOD_ASSIGN, // %=
+  PUNCT_AND_ASSIGN, // &=
+  PUNCT_OR_ASSIGN,  // |=
+  PUNCT_XOR_ASSIGN, // ^=
+  PUNCT_SHL_ASSIGN, // <<=
+  PUNCT_SHR_ASSIGN, // >>=
+  PUNCT_INC,        // ++
+  PUNCT_DEC,        // --
+  PUNCT_LOGAND,     // &&
+  PUNCT_LOGOR,      // ||
+  PUNCT_SHL,        // <<
+  PUNCT_SHR,        // >>
+  PUNCT_HASHHASH,   // ##
+  PUNCT_ELLIPSIS,   // ...
+} Punct;
+
+// Input of the tokenizer. It is a source file, or a piece of text
+// made by the preprocessor, such as the result of "##".
+typedef struct SourceFile SourceFile;
+struct SourceFile
+{
+  char *name;     // Input filename
+  char *path;     // Input (absolute) filepath.
+  char *dir;      // Directory of path, set when first needed
+  char *contents; // Entire input string
+  int file_no;    // File number for .loc directive
+
+  // Offsets of the beginnings of the lines tokenized so far.
+  // The number of them is the current line number.
+  int *line_starts;
+  int num_lines;
+  int line_starts_cap;
+
+  bool lexed_to_end; // The lexer has reached the end of the file
+  bool skipped;      // Some inactive lines were skipped untokenized
+  bool padded;       // contents are zero-filled to a word boundary
+};
+
+// Value of a numeric or string literal token
+typedef struct Literal Literal;
+struct Literal
 {
-  TokenKind kind; // Token kind
-  Token *next;    // Next token
   long val;       // If kind is TK_NUM, its value
   double fval;    // If kind is TK_NUM, its value
-  char *loc;      // Token location
-  int len;        // Length of the token
+  Type *ty;       // Used if TK_NUM
 
   char *contents; // String literal contents including terminating '\0'
   int cont_len;   // String literal length
+};
 
-  Type *ty;       // Used if TK_NUM
-
-  char *filename;   // Input filename
-  char *filepath;   // Input (absolute) filepath.
-  char *input;      // Entire input string
-  int file_no;      // File number for .loc directive
+// Token type
+typedef struct Token Token;
+struct Token
+{
+  Token *next;      // Next token
+  char *loc;        // Token location
+  char *ident;      // If kind is TK_IDENT or a keyword, its interned name
+  Literal *lit;     // If kind is TK_NUM or TK_STR, its value
+  Hideset *hideset; // For macro expansion
+  TokenKind kind;   // Token kind
+  int punct;        // If kind is TK_RESERVED, the character or a Punct
+  int len;          // Length of the token
+  int file;         // Index of the SourceFile this token is read from
   int line_no;      // Line number
   bool at_bol;      // True if this token is at beginning of line
-  bool has_space;    // True if this token follows a space cha
-  Hideset *hideset; // For macro expansionl
+  bool has_space;   // True if this token follows a space character
 };
 
 // Variable
@@ -76,6 +179,8 @@ struct Var
   char *init_data;
   Relocation *rel;
   bool is_static;
+  bool is_literal; // String literal, which is placed in .rodata
+  bool is_tls;     // _Thread_local
 };
 
 // Global variable can be initialized either by a constant expression
@@ -264,6 +369,26 @@ struct Type
   Type *next;
 };
 
+// Hash map
+typedef struct HashEntry HashEntry;
+struct HashEntry
+{
+  char *key;
+  int keylen;
+  void *val;
+};
+
+typedef struct HashMap HashMap;
+struct HashMap
+{
+  HashEntry *buckets;
+  int capacity;
+  int used;
+};
+
+// Buffer of assembly text, defined in emit.c
+typedef struct AsmBuf AsmBuf;
+
 // Struct member
 struct Member
 {
@@ -301,7 +426,9 @@ extern char *output_path;
 extern char **dependencies; // for -MD option
 extern char **include_paths;
 extern bool opt_fpic;
+extern bool opt_E;
 extern bool opt_MD;
+extern int opt_codegen_threads;
 
 /*********************************************
 * ...function declarations...
@@ -311,12 +438,12 @@ extern bool opt_MD;
 
 // Report error
 // Take the same arguments as printf()
-void error(char *fmt, ...);
+_Noreturn void error(char *fmt, ...);
 
 // Report error and error position
-void error_at(char *loc, char *fmt, ...);
+_Noreturn void error_at(char *loc, char *fmt, ...);
 
-void error_tok(Token *tok, char *fmt, ...);
+_Noreturn void error_tok(Token *tok, char *fmt, ...);
 
 void warn_tok(Token *tok, char *fmt, ...);
 
@@ -324,8 +451,16 @@ bool equal(Token *tok, char *s);
 
 Token *skip(Token *tok, char *s);
 
+bool equal_punct(Token *tok, int punct);
+
+Token *skip_punct(Token *tok, char c);
+
 Token *copy_token(Token *tok);
 
+SourceFile *tok_file(Token *tok);
+
+char *intern(char *s, int len);
+
 char **get_input_files();
 
 void convert_keywords(Token *tok);
@@ -333,9 +468,31 @@ void convert_keywords(Token *tok);
 // convert input 'user_input' to token
 Token *tokenize_file(char *filename);
 
+void resume_tokenize(Token *tok);
+
+void tokenize_all(Token *tok);
+
+void skip_inactive(Token *tok);
+
 Token *tokenize(char *filename, int file_no, char *p);
 
+void cache_file(char *path, struct stat *st);
+
+void write_input_files(int fd);
+
+void cache_file_list(char *list);
+
 // ********** preprocess.c *************
+void init_macros();
+
+void define_macro(char *name, char *buf);
+
+void undef_macro(char *name);
+
+void define_macro_arg(char *arg);
+
+void print_macros();
+
 Token *preprocess(Token *tok);
 
 char *get_dir(char *path);
@@ -346,6 +503,10 @@ char *join_paths(char *lhs, char *rhs);
 
 void output_dependencies();
 
+void write_file_lookups(int fd);
+
+void cache_file_lookup(char *path, bool exists);
+
 // ********** parse.c *************
 Node *new_cast(Node *expr, Type *ty);
 
@@ -353,10 +514,22 @@ long const_expr(Token **rest, Token *tok);
 
 Program *parse(Token *tok);
 
+void parse_begin();
+
+Function *parse_function(Token **rest, Token *tok);
+
+Program *parse_end();
+
+void free_nodes();
+
 // ********** codegen.c *************
 
 void codegen(Program *prog);
 
+void codegen_function(Function *fn);
+
+void codegen_end(Program *prog);
+
 // ********** type.c *************
 
 bool is_integer(Type *ty);
@@ -385,6 +558,60 @@ int size_of(Type *ty);
 
 void add_type(Node *node);
 
-// ********** main.c *************
+// ********** hashmap.c *************
+
+void *hashmap_get(HashMap *map, char *key);
+
+void *hashmap_get2(HashMap *map, char *key, int keylen);
+
+void hashmap_put(HashMap *map, char *key, void *val);
+
+void hashmap_put2(HashMap *map, char *key, int keylen, void *val);
+
+void **hashmap_values(HashMap *map);
+
+void hashmap_delete(HashMap *map, char *key);
+
+void hashmap_delete2(HashMap *map, char *key, int keylen);
+
+// ********** assemble.c *************
+
+void assemble_line(char *line);
+
+void write_object_file(char *path);
+
+// ********** emit.c *************
 
 void println(char *fmt, ...);
+
+void emit_to_assembler();
+
+void emit_stream_to(int fd);
+
+void emit_sync();
+
+void emit_begin_front();
+
+void emit_end_front();
+
+AsmBuf *emit_new_buf();
+
+void emit_set_buf(AsmBuf *buf);
+
+void emit_append_buf(AsmBuf *buf);
+
+void emit_flush(int fd);
+
+void emit_assemble();
+
+// ********** server.c *************
+
+int run_client(int argc, char **argv);
+
+int run_server();
+
+int run_batch(char *path);
+
+// ********** main.c *************
+
+int run_compiler(int argc, char **argv);
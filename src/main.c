@@ -1,7 +1,8 @@
 #include "kiwicc.h"
 
-static FILE *tmp_file;
 static char *input_path;
+static char **input_paths;
+static int num_inputs;
 // If -S option is given, the result will be wrote to stdout
 char *output_path = "-";
 static char *tmp_file_path;
@@ -9,21 +10,69 @@ static char *tmp_file_path;
 bool opt_fpic = true;
 
 char **include_paths;
-static bool opt_E;
+bool opt_E;
+static bool opt_dM;
 bool opt_MD;
+int opt_codegen_threads = 1;
 static bool opt_S;
+static bool opt_integrated_as;
+static bool opt_pipe;
+static bool opt_stream_codegen;
+static int opt_j = 1;
+
+// Phases of compilation. -fstop-after=<phase> stops after the phase
+// without writing output.
+typedef enum
+{
+  PHASE_TOKENIZE,
+  PHASE_PREPROCESS,
+  PHASE_PARSE,
+  PHASE_CODEGEN,
+  PHASE_ALL,
+} Phase;
+
+static Phase opt_stop_after = PHASE_ALL;
+
+static char *assembler = "riscv64-unknown-linux-gnu-as";
+static pid_t assembler_pid;
+
+extern char **environ;
+
+// Returns true if the built-in assembler is used instead of
+// writing assembly text.
+static bool use_integrated_as()
+{
+  return opt_integrated_as && !opt_S && opt_stop_after == PHASE_ALL;
+}
+
+// Returns true if functions are generated as soon as they are parsed.
+static bool use_stream_codegen()
+{
+  return opt_stream_codegen && opt_stop_after >= PHASE_CODEGEN;
+}
 
-void println(char *fmt, ...)
+static Phase parse_phase(char *name)
 {
-  va_list ap;
-  va_start(ap, fmt);
-  vfprintf(tmp_file, fmt, ap);
-  fprintf(tmp_file, "\n");
+  if (!strcmp(name, "tokenize"))
+    return PHASE_TOKENIZE;
+  if (!strcmp(name, "preprocess"))
+    return PHASE_PREPROCESS;
+  if (!strcmp(name, "parse"))
+    return PHASE_PARSE;
+  if (!strcmp(name, "codegen"))
+    return PHASE_CODEGEN;
+  error("unknown phase: %s", name);
 }
 
 static void usage(int status)
 {
-  fprintf(stderr, "kiwicc [ -o <path> ] [ -fpic | -fno-pic ] [ -E ] <file>\n");
+  fprintf(stderr, "kiwicc [ -o <path> ] [ -fpic | -fno-pic ] [ -fintegrated-as ] [ -pipe ] [ -j <jobs> ] [ -fstream-codegen ]\n"
+                  "       [ -fcodegen-threads=<n> ]\n"
+                  "       [ -fsyntax-only | -fstop-after=<phase> ] [ -E [ -dM ] ]\n"
+                  "       [ -D <name>[=<value>] ] [ -U <name> ] <file>...\n");
+  fprintf(stderr, "kiwicc @<file>\n");
+  fprintf(stderr, "kiwicc --server\n");
+  fprintf(stderr, "kiwicc --client <arguments>...\n");
   exit(status);
 }
 
@@ -111,12 +160,109 @@ static void parse_args(int argc, char **argv)
       continue;
     }
 
+    if (!strcmp(argv[i], "-fintegrated-as"))
+    {
+      opt_integrated_as = true;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-fno-integrated-as"))
+    {
+      opt_integrated_as = false;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-fsyntax-only"))
+    {
+      opt_stop_after = PHASE_PARSE;
+      continue;
+    }
+
+    if (!strncmp(argv[i], "-fstop-after=", 13))
+    {
+      opt_stop_after = parse_phase(argv[i] + 13);
+      continue;
+    }
+
+    if (!strncmp(argv[i], "-fcodegen-threads=", 18))
+    {
+      opt_codegen_threads = atoi(argv[i] + 18);
+      if (opt_codegen_threads < 1)
+        error("invalid number of threads: %s", argv[i] + 18);
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-fstream-codegen"))
+    {
+      opt_stream_codegen = true;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-pipe"))
+    {
+      opt_pipe = true;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-j"))
+    {
+      if (!argv[++i])
+        usage(1);
+      opt_j = atoi(argv[i]);
+      if (opt_j < 1)
+        error("invalid number of jobs: %s", argv[i]);
+      continue;
+    }
+
+    if (!strncmp(argv[i], "-j", 2))
+    {
+      opt_j = atoi(argv[i] + 2);
+      if (opt_j < 1)
+        error("invalid number of jobs: %s", argv[i] + 2);
+      continue;
+    }
+
     if (!strcmp(argv[i], "-E"))
     {
       opt_E = true;
       continue;
     }
 
+    if (!strcmp(argv[i], "-dM"))
+    {
+      opt_dM = true;
+      continue;
+    }
+
+    // -D and -U are applied to the predefined macros in order.
+    if (!strcmp(argv[i], "-D"))
+    {
+      if (!argv[++i])
+        usage(1);
+      define_macro_arg(argv[i]);
+      continue;
+    }
+
+    if (!strncmp(argv[i], "-D", 2))
+    {
+      define_macro_arg(argv[i] + 2);
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-U"))
+    {
+      if (!argv[++i])
+        usage(1);
+      undef_macro(argv[i]);
+      continue;
+    }
+
+    if (!strncmp(argv[i], "-U", 2))
+    {
+      undef_macro(argv[i] + 2);
+      continue;
+    }
+
     if (!strcmp(argv[i], "-Wall"))
     {
       // ignore
@@ -180,19 +326,25 @@ static void parse_args(int argc, char **argv)
     if (argv[i][0] == '-' && argv[i][1] != '\0')
       error("unknown argument: %s", argv[i]);
 
-    input_path = argv[i];
-    if (*input_path != '/')
+    // "-" is the standard input.
+    char *path = argv[i];
+    if (*path != '/' && strcmp(path, "-"))
     {
       // Convert relative path to to absolute path
       char cwd[PATHNAME_SIZE]; 
       memset(cwd, '\0', PATHNAME_SIZE); 
       getcwd(cwd, PATHNAME_SIZE);
-      input_path = rel_to_abs(cwd, input_path);
+      path = rel_to_abs(cwd, path);
     } 
+    input_paths = realloc(input_paths, sizeof(char *) * (num_inputs + 1));
+    input_paths[num_inputs++] = path;
   }
 
-  if (!input_path)
+  if (num_inputs == 0)
     error("no input files");
+
+  if (num_inputs > 1 && strcmp(output_path, "-") && !opt_E)
+    error("cannot specify -o with multiple files");
 }
 
 // Print tokens to stdout. Used for -E.
@@ -211,41 +363,119 @@ static void print_tokens(Token *tok)
   printf("\n");
 }
 
-static void copy_file(FILE *in, FILE *out)
+// Open `path` for writing the output. "-" means stdout.
+static int open_output_file(char *path)
 {
-  char buf[4096];
-  for (;;)
+  if (!strcmp(path, "-"))
+    return STDOUT_FILENO;
+
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd == -1)
+    error("cannot open output file: %s: %s", path, strerror(errno));
+  return fd;
+}
+
+// Start the assembler to write an object file to `output_path`.
+// If `input` is NULL, the assembler reads the assembly from the pipe
+// whose write end is returned.
+static int spawn_assembler(char *input)
+{
+  char *argv[] = {assembler, "-o", output_path, input, NULL};
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+
+  int fds[2] = {-1, -1};
+  if (!input)
   {
-    int nr = fread(buf, 1, sizeof(buf), in);
-    if (nr == 0)
-      break;
-    fwrite(buf, 1, nr, out);
+    if (pipe(fds) == -1)
+      error("pipe failed: %s", strerror(errno));
+    posix_spawn_file_actions_adddup2(&actions, fds[0], STDIN_FILENO);
+    posix_spawn_file_actions_addclose(&actions, fds[0]);
+    posix_spawn_file_actions_addclose(&actions, fds[1]);
   }
+
+  // Unlike fork(), posix_spawn() doesn't copy our (large) address space.
+  int err = posix_spawnp(&assembler_pid, assembler, &actions, NULL, argv, environ);
+  if (err)
+    error("exec failed: %s: %s", assembler, strerror(err));
+  posix_spawn_file_actions_destroy(&actions);
+
+  if (fds[0] != -1)
+  {
+    close(fds[0]);
+    // Report a write error instead of being killed if the assembler
+    // quits without reading everything.
+    signal(SIGPIPE, SIG_IGN);
+  }
+  return fds[1];
+}
+
+// Wait for the assembler to finish.
+static void wait_assembler()
+{
+  int status;
+  while (waitpid(assembler_pid, &status, 0) == -1)
+    if (errno != EINTR)
+      error("waitpid failed: %s", strerror(errno));
+  assembler_pid = 0;
+
+  // The assembler has already reported the error.
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    exit(1);
 }
 
 static void cleanup()
 {
   if (tmp_file_path)
     unlink(tmp_file_path);
+
+  // If we are exiting while the assembler is still reading our output,
+  // the output is incomplete. Don't leave a broken object file.
+  if (assembler_pid)
+  {
+    kill(assembler_pid, SIGKILL);
+    waitpid(assembler_pid, NULL, 0);
+    unlink(output_path);
+  }
 }
 
-int main(int argc, char **argv)
+// Compile `input_path` to `output_path`.
+static void compile_file()
 {
-  add_default_include_paths(argv[0]);
-  parse_args(argc, argv);
-  atexit(cleanup);
+  // If -S option not is given, the result will be wrote to "a.out"
+  if (!opt_S && !strcmp(output_path, "-"))
+    output_path = "a.out";
 
-  // Open a tmporary output file.
-  tmp_file_path = strdup("/tmp/kiwicc-XXXXXX");
-  int fd = mkstemp(tmp_file_path);
-  if (!fd)
-    error("cannot open output file: %s: %s", tmp_file_path, strerror(errno)); 
-  tmp_file = fdopen(fd, "w");
+  // The built-in assembler takes the assembly line by line.
+  // With -pipe, the external assembler is started now and
+  // takes the assembly function by function.
+  // In the streaming codegen, the globals are emitted last but put
+  // in front of the functions, so the output is kept until the end.
+  int pipe_fd = -1;
+  if (use_integrated_as() && !use_stream_codegen())
+  {
+    emit_to_assembler();
+  }
+  else if (opt_pipe && !opt_S && !opt_E && opt_stop_after == PHASE_ALL)
+  {
+    pipe_fd = spawn_assembler(NULL);
+    if (!use_stream_codegen())
+      emit_stream_to(pipe_fd);
+  }
 
   // Tokenize
   Token *token = tokenize_file(input_path);
   if (!token)
-    error("cannot open %s: %s", argv[1], strerror(errno));
+    error("cannot open %s: %s", input_path, strerror(errno));
+
+  // With -E, print out the tokens before preprocessing.
+  if (opt_stop_after == PHASE_TOKENIZE)
+  {
+    tokenize_all(token);
+    if (opt_E)
+      print_tokens(token);
+    return;
+  }
 
   // Preprocess
   token = preprocess(token);
@@ -253,84 +483,244 @@ int main(int argc, char **argv)
   if (opt_MD)
     output_dependencies();
 
-  // If -E is given, print out preprocessed C code as a result
+  // If -E is given, print out preprocessed C code as a result,
+  // or the defined macros with -dM.
   if (opt_E)
   {
-    print_tokens(token);
-    exit(0);
+    if (opt_dM)
+      print_macros();
+    else
+      print_tokens(token);
+    return;
   }
 
-  // Parse
-  // Program *prog = program_old();
-  Program *prog = parse(token);
+  if (opt_stop_after == PHASE_PREPROCESS)
+    return;
 
-  // Assign offsets to local variables.
-  for (Function *fn = prog->fns; fn; fn = fn->next)
+  // Parse and generate code function by function, releasing
+  // the AST of each function after its code is generated.
+  if (use_stream_codegen())
   {
-    // Besides local variables, callee-saved registers take 23 bytes
-    // and the variable-argument save takes 31 bytes in the stack.
-    int offset = fn->is_variadic ? 248 : 184;
-
-    for (VarList *vl = fn->locals; vl; vl = vl->next)
+    parse_begin();
+    for (Function *fn; (fn = parse_function(&token, token));)
     {
-      offset = align_to(offset, vl->var->align);
-      offset += size_of(vl->var->ty);
-      vl->var->offset = offset;
+      codegen_function(fn);
+      free_nodes();
     }
-    fn->stack_size = align_to(offset, 16);
+    codegen_end(parse_end());
+
+    if (use_integrated_as())
+      emit_assemble();
+  }
+  else
+  {
+    // Parse
+    // Program *prog = program_old();
+    Program *prog = parse(token);
+
+    if (opt_stop_after == PHASE_PARSE)
+      return;
+
+    // generate code
+    codegen(prog);
   }
 
-  // generate code
-  codegen(prog);
+  if (opt_stop_after == PHASE_CODEGEN)
+    return;
 
   // If -S if given, assermbly text is the final output.
   if (opt_S)
   {
-    fseek(tmp_file, 0, SEEK_SET);
+    int fd = open_output_file(output_path);
+    emit_flush(fd);
+    if (fd != STDOUT_FILENO)
+      close(fd);
+    return;
+  }
 
-    FILE *out;
-    if (strcmp(output_path, "-") == 0)
-    {
-      out = stdout;
-    }
-    else
-    {
-      out = fopen(output_path, "w");
-      if (!out)
-        error("cannot open output file: %s: %s", output_path, strerror(errno));
-    }
-    copy_file(tmp_file, out);
-    exit(0);
+  // The built-in assembler has already assembled our output.
+  if (use_integrated_as())
+  {
+    write_object_file(output_path);
+    return;
   }
 
-  // Otherwise, run the assembler to assemble our output.
-  fclose(tmp_file);
-  // If -S option not is given, the result will be wrote to "a.out"
-  if (!strcmp(output_path, "-"))
-    output_path = "a.out";
+  if (pipe_fd != -1)
+  {
+    emit_flush(pipe_fd);
+    close(pipe_fd);
+    wait_assembler();
+    return;
+  }
+
+  // Otherwise, write our output to a temporary file and
+  // run the assembler to assemble it.
+  tmp_file_path = strdup("/tmp/kiwicc-XXXXXX");
+  int fd = mkstemp(tmp_file_path);
+  if (fd == -1)
+    error("cannot open output file: %s: %s", tmp_file_path, strerror(errno));
+  emit_flush(fd);
+  close(fd);
 
+  spawn_assembler(tmp_file_path);
+  wait_assembler();
+}
+
+/*** Parallel compilation ***/
+
+// If more than one input file is given, each file is compiled in
+// a child process, and up to `opt_j` children run at the same time.
+// Their diagnostics (and output if -E) are written to temporary
+// files and reported in the order of the input files, so that the
+// result doesn't depend on which child finishes first.
+
+typedef struct Job Job;
+struct Job
+{
   pid_t pid;
-  if ((pid = fork() == 0))
+  FILE *out;
+  FILE *err;
+  bool done;
+  bool failed;
+};
+
+// Returns the basename of `path` with its extension replaced with `extn`.
+static char *replace_extn(char *path, char *extn)
+{
+  char *filename = basename(strdup(path));
+  char *dot = strrchr(filename, '.');
+  if (dot)
+    *dot = '\0';
+  char *buf = malloc(strlen(filename) + strlen(extn) + 1);
+  strcpy(buf, filename);
+  strcat(buf, extn);
+  return buf;
+}
+
+static void copy_file(FILE *in, FILE *out)
+{
+  char buf[4096];
+  rewind(in);
+  for (size_t n; (n = fread(buf, 1, sizeof(buf), in)) > 0;)
+    fwrite(buf, 1, n, out);
+  fclose(in);
+}
+
+static void start_job(Job *job, char *path)
+{
+  job->out = tmpfile();
+  job->err = tmpfile();
+  if (!job->out || !job->err)
+    error("cannot create temporary file: %s", strerror(errno));
+
+  fflush(stdout);
+  fflush(stderr);
+  job->pid = fork();
+  if (job->pid == -1)
+    error("fork failed: %s", strerror(errno));
+
+  if (job->pid == 0)
   {
-    // Child process. Run the assembler.
-    execlp("riscv64-unknown-linux-gnu-as", "-c", "-o", output_path, tmp_file_path, (char *)0);
-    fprintf(stderr, "exec failed: as: %s", strerror(errno));
-    _exit(1); 
+    dup2(fileno(job->out), STDOUT_FILENO);
+    dup2(fileno(job->err), STDERR_FILENO);
+    input_path = path;
+    if (!opt_E)
+      output_path = replace_extn(path, opt_S ? ".s" : ".o");
+    compile_file();
+    exit(0);
   }
+}
 
-  // Wait for the child process to finish.
-  for (;;)
+// Wait for any job to finish. Returns false if there is no running job.
+static bool wait_job(Job *jobs, int njobs)
+{
+  int status;
+  pid_t pid;
+  while ((pid = wait(&status)) == -1)
   {
-    int status;
-    int w = waitpid(pid, &status, 0);
-    if (!w)
+    if (errno == ECHILD)
+      return false;
+    if (errno != EINTR)
+      error("wait failed: %s", strerror(errno));
+  }
+
+  for (int i = 0; i < njobs; i++)
+  {
+    if (jobs[i].pid == pid)
     {
-      error("waitpid failed: %s", strerror(errno));
-      exit(1);
+      jobs[i].done = true;
+      jobs[i].failed = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
     }
-    if (WIFEXITED(status))
-      break;
   }
+  return true;
+}
+
+static int compile_files()
+{
+  Job *jobs = calloc(num_inputs, sizeof(Job));
+  int started = 0;
+  int reported = 0;
+  int running = 0;
+  bool failed = false;
+
+  while (reported < num_inputs)
+  {
+    while (started < num_inputs && running < opt_j)
+    {
+      start_job(&jobs[started], input_paths[started]);
+      started++;
+      running++;
+    }
 
+    if (!wait_job(jobs, started))
+      error("internal error: no running job");
+    running--;
+
+    // Report the finished jobs in order.
+    for (; reported < started && jobs[reported].done; reported++)
+    {
+      copy_file(jobs[reported].out, stdout);
+      copy_file(jobs[reported].err, stderr);
+      fflush(stdout);
+      failed |= jobs[reported].failed;
+    }
+  }
+  return failed ? 1 : 0;
+}
+
+// Compile as `argv` says. argv[0] is ignored.
+int run_compiler(int argc, char **argv)
+{
+  parse_args(argc, argv);
+
+  if (num_inputs > 1)
+    return compile_files();
+
+  input_path = input_paths[0];
+  compile_file();
   return 0;
 }
+
+int main(int argc, char **argv)
+{
+  add_default_include_paths(argv[0]);
+  init_macros();
+  atexit(cleanup);
+
+  if (argc == 2 && !strcmp(argv[1], "--server"))
+    return run_server();
+
+  if (argc == 2 && argv[1][0] == '@')
+    return run_batch(argv[1] + 1);
+
+  // Compile by ourselves if the server is not running.
+  if (argc > 1 && !strcmp(argv[1], "--client"))
+  {
+    int status = run_client(argc - 1, argv + 1);
+    if (status != -1)
+      return status;
+    return run_compiler(argc - 1, argv + 1);
+  }
+
+  return run_compiler(argc, argv);
+}
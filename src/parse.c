@@ -35,6 +35,7 @@ typedef struct
   bool is_typedef;
   bool is_static;
   bool is_extern;
+  bool is_tls;
   int align;
 } VarAttr;
 
@@ -84,6 +85,9 @@ static TagScope *tag_scope;
 // by one at "}"
 static int scope_depth;
 
+// String literals by their contents. Identical literals share a variable.
+static HashMap string_literals;
+
 // Points to the function object the parse is currently parsing.
 static Var *current_fn;
 
@@ -91,6 +95,21 @@ static Var *current_fn;
 // a switch statement. Otherwise, NULL.
 static Node *current_switch;
 
+// Nodes are allocated from blocks so that the ASTs can be released
+// at once after their code is generated.
+#define NODES_PER_BLOCK 1024
+
+typedef struct NodeBlock NodeBlock;
+struct NodeBlock
+{
+  NodeBlock *next;
+  int used;
+  Node nodes[NODES_PER_BLOCK];
+};
+
+static NodeBlock *node_blocks;
+static NodeBlock *free_node_blocks;
+
 static bool is_typename(Token *tok);
 static Type *typespec(Token **rest, Token *tok, VarAttr *attr);
 static Type *typename(Token **rest, Token *tok);
@@ -132,9 +151,41 @@ static Node *postfix(Token **rest, Token *tok);
 static Node *funcall(Token **rest, Token *tok, Node *node);
 static Node *primary(Token **rest, Token *tok);
 
+static Node *alloc_node()
+{
+  if (!node_blocks || node_blocks->used == NODES_PER_BLOCK)
+  {
+    NodeBlock *blk = free_node_blocks;
+    if (blk)
+      free_node_blocks = blk->next;
+    else
+      blk = malloc(sizeof(NodeBlock));
+    blk->next = node_blocks;
+    blk->used = 0;
+    node_blocks = blk;
+  }
+
+  Node *node = &node_blocks->nodes[node_blocks->used++];
+  memset(node, 0, sizeof(Node));
+  return node;
+}
+
+// Release all the nodes allocated so far. The memory is reused
+// for the nodes allocated later.
+void free_nodes()
+{
+  while (node_blocks)
+  {
+    NodeBlock *blk = node_blocks;
+    node_blocks = blk->next;
+    blk->next = free_node_blocks;
+    free_node_blocks = blk;
+  }
+}
+
 static Node *new_node(NodeKind kind, Token *tok)
 {
-  Node *node = calloc(1, sizeof(Node));
+  Node *node = alloc_node();
   node->kind = kind;
   node->tok = tok;
   return node;
@@ -237,7 +288,7 @@ static VarScope *find_var(Token *tok)
 {
   for (VarScope *sc = var_scope; sc; sc = sc->next)
   {
-    if (strlen(sc->name) == tok->len && !strncmp(tok->loc, sc->name, tok->len))
+    if (sc->name == tok->ident)
       return sc;
   }
   return NULL;
@@ -248,7 +299,7 @@ static TagScope *find_tag(Token *tok)
 {
   for (TagScope *sc = tag_scope; sc; sc = sc->next)
   {
-    if (strlen(sc->name) == tok->len && !strncmp(tok->loc, sc->name, tok->len))
+    if (sc->name == tok->ident)
       return sc;
   }
   return NULL;
@@ -258,7 +309,7 @@ Node *new_cast(Node *expr, Type *ty)
 {
   add_type(expr);
 
-  Node *node = calloc(1, sizeof(Node));
+  Node *node = alloc_node();
   node->kind = ND_CAST;
   node->tok = expr->tok;
   node->lhs = expr;
@@ -280,7 +331,7 @@ static void push_tag_scope(Token *tok, Type *ty)
 {
   TagScope *sc = calloc(1, sizeof(TagScope));
   sc->next = tag_scope;
-  sc->name = strndup(tok->loc, tok->len);
+  sc->name = tok->ident;
   sc->depth = scope_depth;
   sc->ty = ty;
   tag_scope = sc;
@@ -335,9 +386,15 @@ static char *new_unique_name()
 
 static Var *new_string_literal(char *p, int len)
 {
+  Var *var = hashmap_get2(&string_literals, p, len);
+  if (var)
+    return var;
+
   Type *ty = array_of(char_type, len);
-  Var *var = new_gvar(new_unique_name(), ty, true, true);
+  var = new_gvar(new_unique_name(), ty, true, true);
   var->init_data = p;
+  var->is_literal = true;
+  hashmap_put2(&string_literals, p, len, var);
   return var;
 }
 
@@ -345,7 +402,7 @@ static char *get_ident(Token *tok)
 {
   if (tok->kind != TK_IDENT)
     error_tok(tok, "expected an identifier");
-  return strndup(tok->loc, tok->len);
+  return tok->ident;
 }
 
 static Type *find_typedef(Token *tok)
@@ -363,20 +420,25 @@ static long get_number(Token *tok)
 {
   if (tok->kind != TK_NUM)
     error_tok(tok, "expected a number");
-  return tok->val;
+  return tok->lit->val;
 }
 
-// program = (global-var | funcdef)*
-Program *parse(Token *tok)
+// Parsing can be done in a streaming way. parse_function() returns
+// a function as soon as it is parsed, so that the caller can
+// generate its code and release its AST before parsing the rest.
+void parse_begin()
 {
   // Add build-in function types
-  new_gvar("__builtin_va_start", func_type(void_type), true, false);
-
-  // Read source code until EOF.
-  Function head = {};
-  Function *cur = &head;
+  new_gvar(intern("__builtin_va_start", 18), func_type(void_type), true, false);
   globals = NULL;
+}
 
+// program = (global-var | funcdef)*
+//
+// Parse top-level declarations up to the next function definition
+// and return the function, or NULL at the end of the input.
+Function *parse_function(Token **rest, Token *tok)
+{
   while (tok->kind != TK_EOF)
   {
     Token *start = tok;
@@ -384,7 +446,7 @@ Program *parse(Token *tok)
     Type *basety = typespec(&tok, tok, &attr);
 
     // Typename-only declarations
-    if (equal(tok, ";"))
+    if (equal_punct(tok, ';'))
     {
       if (attr.is_typedef)
         error_tok(tok, "typedef name omitted");
@@ -399,12 +461,12 @@ Program *parse(Token *tok)
       for (;;)
       {
         push_scope(get_ident(ty->name))->type_def = ty;
-        if (equal(tok, ";"))
+        if (equal_punct(tok, ';'))
         {
           tok = tok->next;
           break;
         }
-        tok = skip(tok, ",");
+        tok = skip_punct(tok, ',');
         ty = declarator(&tok, tok, basety);
       }
       continue;
@@ -413,24 +475,30 @@ Program *parse(Token *tok)
     // Function
     if (ty->kind == TY_FUNC)
     {
+      Function *fn = NULL;
       for (;;)
       {
         current_fn = new_gvar(get_ident(ty->name), ty, attr.is_static, false);
-        if (equal(tok, ";"))
+        if (equal_punct(tok, ';'))
         {
           tok = tok->next;
           break;
         }
-        if (equal(tok, ","))
+        if (equal_punct(tok, ','))
         {
-          tok = skip(tok, ",");
+          tok = skip_punct(tok, ',');
           ty = declarator(&tok, tok, basety);
           continue;
         }
 
-        cur = cur->next = funcdef(&tok, start);
+        fn = funcdef(&tok, start);
         break;
       }
+      if (fn)
+      {
+        *rest = tok;
+        return fn;
+      }
       continue;
     }
 
@@ -438,24 +506,46 @@ Program *parse(Token *tok)
     for (;;)
     {
       Var *var = new_gvar(get_ident(ty->name), ty, attr.is_static, !attr.is_extern);
+      var->is_tls = attr.is_tls;
       if (attr.align)
         var->align = attr.align;
 
-      if (equal(tok, "="))
+      if (equal_punct(tok, '='))
         gvar_initializer(&tok, tok->next, var);
 
-      if (equal(tok, ";"))
+      if (equal_punct(tok, ';'))
       {
         tok = tok->next;
         break;
       }
-      tok = skip(tok, ",");
+      tok = skip_punct(tok, ',');
       ty = declarator(&tok, tok, basety);
     }
   }
 
+  *rest = tok;
+  return NULL;
+}
+
+// Returns the global variables after all functions are parsed.
+Program *parse_end()
+{
   Program *prog = calloc(1, sizeof(Program));
   prog->globals = globals;
+  return prog;
+}
+
+Program *parse(Token *tok)
+{
+  parse_begin();
+
+  // Read source code until EOF.
+  Function head = {};
+  Function *cur = &head;
+  for (Function *fn; (fn = parse_function(&tok, tok));)
+    cur = cur->next = fn;
+
+  Program *prog = parse_end();
   prog->fns = head.next;
   return prog;
 }
@@ -559,35 +649,8 @@ static void *gvar_initializer(Token **rest, Token *tok, Var *var)
 // Returns true if a givin token represents a type
 static bool is_typename(Token *tok)
 {
-  static char *kw[] =
-      {
-          "void",
-          "_Bool",
-          "char",
-          "short",
-          "int",
-          "long",
-          "struct",
-          "union",
-          "typedef",
-          "enum",
-          "static",
-          "extern",
-          "_Alignas",
-          "signed",
-          "unsigned",
-          "const",
-          "volatile",
-          "register",
-          "_Noreturn",
-          "inline",
-          "float",
-          "double"
-      };
-
-  for (int i = 0; i < sizeof(kw) / sizeof(*kw); i++)
-    if (equal(tok, kw[i]))
-      return true;
+  if (TK_KW_VOID <= tok->kind && tok->kind <= TK_KW_DOUBLE)
+    return true;
   return find_typedef(tok);
 }
 
@@ -596,7 +659,7 @@ static bool is_typename(Token *tok)
 static void add_func_ident(char *func)
 {
   Var *var = new_string_literal(func, strlen(func) + 1);
-  push_scope("__func__")->var = var;
+  push_scope(intern("__func__", 8))->var = var;
 }
 
 // funcdef = typespec declarator compound-stmt
@@ -622,7 +685,7 @@ static Function *funcdef(Token **rest, Token *tok)
   }
   fn->params = locals;
 
-  tok = skip(tok, "{");
+  tok = skip_punct(tok, '{');
   add_func_ident(fn->name);
   fn->node = compound_stmt(rest, tok)->body;
   fn->locals = locals;
@@ -654,15 +717,18 @@ static Type *typespec(Token **rest, Token *tok, VarAttr *attr)
   while (is_typename(tok))
   {
     // Handle storage class specifiers.
-    if (equal(tok, "typedef") || equal(tok, "static")
-        || equal(tok, "extern") || equal(tok, "inline"))
+    if (tok->kind == TK_KW_TYPEDEF || tok->kind == TK_KW_STATIC
+        || tok->kind == TK_KW_EXTERN || tok->kind == TK_KW_INLINE
+        || tok->kind == TK_KW_THREAD_LOCAL)
     {
       if (!attr)
         error_tok(tok, "storage class specifier is not allowed in this context.");
-      if (equal(tok, "typedef"))
+      if (tok->kind == TK_KW_TYPEDEF)
         attr->is_typedef = true;
-      else if (equal(tok, "static"))
+      else if (tok->kind == TK_KW_STATIC)
         attr->is_static = true;
+      else if (tok->kind == TK_KW_THREAD_LOCAL)
+        attr->is_tls = true;
       else
         attr->is_extern = true;
 
@@ -672,46 +738,46 @@ static Type *typespec(Token **rest, Token *tok, VarAttr *attr)
       continue;
     }
 
-    if (equal(tok, "const"))
+    if (tok->kind == TK_KW_CONST)
     {
       tok = tok->next;
       is_const = true;
       continue;
     }
 
-    if (equal(tok, "volatile") || equal(tok, "register") || equal(tok, "_Noreturn"))
+    if (tok->kind == TK_KW_VOLATILE || tok->kind == TK_KW_REGISTER || tok->kind == TK_KW_NORETURN)
     {
       tok = tok->next;
       continue;
     }
 
-    if (equal(tok, "_Alignas"))
+    if (tok->kind == TK_KW_ALIGNAS)
     {
       if (!attr)
         error_tok(tok, "_Alignas is not allowed in this context");
-      tok = skip(tok->next, "(");
+      tok = skip_punct(tok->next, '(');
 
       if (is_typename(tok))
         attr->align = typename(&tok, tok)->align;
       else
         attr->align = const_expr(&tok, tok);
-      tok = skip(tok, ")");
+      tok = skip_punct(tok, ')');
       continue;
     }
 
     // Handle user-defined types.
     Type *ty2 = find_typedef(tok);
-    if (equal(tok, "struct") || equal(tok, "union") ||
-        equal(tok, "enum") || ty2)
+    if (tok->kind == TK_KW_STRUCT || tok->kind == TK_KW_UNION ||
+        tok->kind == TK_KW_ENUM || ty2)
     {
       if (counter)
         break;
 
-      if (equal(tok, "struct"))
+      if (tok->kind == TK_KW_STRUCT)
         ty = struct_decl(&tok, tok->next);
-      else if (equal(tok, "union"))
+      else if (tok->kind == TK_KW_UNION)
         ty = union_decl(&tok, tok->next);
-      else if (equal(tok, "enum"))
+      else if (tok->kind == TK_KW_ENUM)
         ty = enum_specifier(&tok, tok->next);
       else
       {
@@ -723,25 +789,25 @@ static Type *typespec(Token **rest, Token *tok, VarAttr *attr)
     }
 
     // Handle built-in types.
-    if (equal(tok, "void"))
+    if (tok->kind == TK_KW_VOID)
       counter += VOID;
-    else if (equal(tok, "_Bool"))
+    else if (tok->kind == TK_KW_BOOL)
       counter += BOOL;
-    else if (equal(tok, "char"))
+    else if (tok->kind == TK_KW_CHAR)
       counter += CHAR;
-    else if (equal(tok, "short"))
+    else if (tok->kind == TK_KW_SHORT)
       counter += SHORT;
-    else if (equal(tok, "int"))
+    else if (tok->kind == TK_KW_INT)
       counter += INT;
-    else if (equal(tok, "long"))
+    else if (tok->kind == TK_KW_LONG)
       counter += LONG;
-    else if (equal(tok, "signed"))
+    else if (tok->kind == TK_KW_SIGNED)
       counter |= SIGNED;
-    else if (equal(tok, "unsigned"))
+    else if (tok->kind == TK_KW_UNSIGNED)
       counter |= UNSIGNED;
-    else if (equal(tok, "float"))
+    else if (tok->kind == TK_KW_FLOAT)
       counter += FLOAT;
-    else if (equal(tok, "double"))
+    else if (tok->kind == TK_KW_DOUBLE)
       counter += DOUBLE;
     else
       error_tok(tok, "internal error");
@@ -824,18 +890,18 @@ static Type *typespec(Token **rest, Token *tok, VarAttr *attr)
 
 static bool is_end(Token *tok)
 {
-  return equal(tok, "}") || (equal(tok, ",") && equal(tok->next, "}"));
+  return equal_punct(tok, '}') || (equal_punct(tok, ',') && equal_punct(tok->next, '}'));
 }
 
 static bool consume_end(Token **rest, Token *tok)
 {
-  if (equal(tok, "}"))
+  if (equal_punct(tok, '}'))
   {
     *rest = tok->next;
     return true;
   }
 
-  if (equal(tok, ",") && equal(tok->next, "}"))
+  if (equal_punct(tok, ',') && equal_punct(tok->next, '}'))
   {
     *rest = tok->next->next;
     return true;
@@ -860,7 +926,7 @@ static Type *enum_specifier(Token **rest, Token *tok)
     tok = tok->next;
   }
 
-  if (tag && !equal(tok, "{"))
+  if (tag && !equal_punct(tok, '{'))
   {
     TagScope *sc = find_tag(tag);
     if (!sc)
@@ -871,7 +937,7 @@ static Type *enum_specifier(Token **rest, Token *tok)
     return sc->ty;
   }
 
-  tok = skip(tok, "{");
+  tok = skip_punct(tok, '{');
 
   // Read an enum-list.
   int i = 0;
@@ -879,12 +945,12 @@ static Type *enum_specifier(Token **rest, Token *tok)
   while (!consume_end(rest, tok))
   {
     if (i++ > 0)
-      tok = skip(tok, ",");
+      tok = skip_punct(tok, ',');
 
     char *name = get_ident(tok);
     tok = tok->next;
 
-    if (equal(tok, "="))
+    if (equal_punct(tok, '='))
       val = const_expr(&tok, tok->next);
 
     VarScope *sc = push_scope(name);
@@ -901,7 +967,7 @@ static Type *enum_specifier(Token **rest, Token *tok)
 // param       = typespec declarator
 static Type *func_params(Token **rest, Token *tok, Type *ty)
 {
-  if (equal(tok, "void") && equal(tok->next, ")"))
+  if (tok->kind == TK_KW_VOID && equal_punct(tok->next, ')'))
   {
     *rest = tok->next->next;
     return func_type(ty);
@@ -911,16 +977,16 @@ static Type *func_params(Token **rest, Token *tok, Type *ty)
   Type *cur = &head;
   bool is_variadic = false;
 
-  while (!equal(tok, ")"))
+  while (!equal_punct(tok, ')'))
   {
     if (cur != &head)
-      tok = skip(tok, ",");
+      tok = skip_punct(tok, ',');
 
-    if (equal(tok, "..."))
+    if (equal_punct(tok, PUNCT_ELLIPSIS))
     {
       is_variadic = true;
       tok = tok->next;
-      skip(tok, ")");
+      skip_punct(tok, ')');
       break;
     }
 
@@ -946,10 +1012,15 @@ static Type *func_params(Token **rest, Token *tok, Type *ty)
   return ty;
 }
 
-// array-dimensions = const-expr? "]" type-suffix
+// array-dimensions = ("static" | "restrict" | "const" | "volatile")* const-expr? "]" type-suffix
 static Type *array_dimensions(Token **rest, Token *tok, Type *ty)
 {
-  if (equal(tok, "]"))
+  // Qualifiers in array parameter declarations are ignored.
+  while (tok->kind == TK_KW_STATIC || tok->kind == TK_KW_RESTRICT ||
+         tok->kind == TK_KW_CONST || tok->kind == TK_KW_VOLATILE)
+    tok = tok->next;
+
+  if (equal_punct(tok, ']'))
   {
     ty = type_suffix(rest, tok->next, ty);
     ty = array_of(ty, -1);
@@ -958,7 +1029,7 @@ static Type *array_dimensions(Token **rest, Token *tok, Type *ty)
   }
 
   int len = const_expr(&tok, tok);
-  tok = skip(tok, "]");
+  tok = skip_punct(tok, ']');
   ty = type_suffix(rest, tok, ty);
   return array_of(ty, len);
 }
@@ -968,10 +1039,10 @@ static Type *array_dimensions(Token **rest, Token *tok, Type *ty)
 //             | ε
 static Type *type_suffix(Token **rest, Token *tok, Type *ty)
 {
-  if (equal(tok, "("))
+  if (equal_punct(tok, '('))
     return func_params(rest, tok->next, ty);
 
-  if (equal(tok, "["))
+  if (equal_punct(tok, '['))
   {
     return array_dimensions(rest, tok->next, ty);
   }
@@ -983,13 +1054,13 @@ static Type *type_suffix(Token **rest, Token *tok, Type *ty)
 // pointers = ("*" ("const" | "volatile" | "restrict")*)*
 static Type *pointers(Token **rest, Token *tok, Type *ty)
 {
-  while (equal(tok, "*"))
+  while (equal_punct(tok, '*'))
   {
     tok = tok->next;
     ty = pointer_to(ty);
-    while (equal(tok, "const") || equal(tok, "volatile") || equal(tok, "restrict"))
+    while (tok->kind == TK_KW_CONST || tok->kind == TK_KW_VOLATILE || tok->kind == TK_KW_RESTRICT)
     {
-      if (equal(tok, "const"))
+      if (tok->kind == TK_KW_CONST)
         ty->is_const = true;
       tok = tok->next;
     }
@@ -1003,11 +1074,11 @@ static Type *declarator(Token **rest, Token *tok, Type *ty)
 {
   ty = pointers(&tok, tok, ty);
 
-  if (equal(tok, "("))
+  if (equal_punct(tok, '('))
   {
     Type *placeholder = calloc(1, sizeof(Type));
     Type *new_ty = declarator(&tok, tok->next, placeholder);
-    tok = skip(tok, ")");
+    tok = skip_punct(tok, ')');
     *placeholder = *type_suffix(rest, tok, ty);
     return new_ty;
   }
@@ -1029,17 +1100,17 @@ static Type *declarator(Token **rest, Token *tok, Type *ty)
 // abstract-declarator = "*"* ("(" abstract-declarator ")")? type-suffix
 static Type *abstract_declarator(Token **rest, Token *tok, Type *ty)
 {
-  while (equal(tok, "*"))
+  while (equal_punct(tok, '*'))
   {
     ty = pointer_to(ty);
     tok = tok->next;
   }
 
-  if (equal(tok, "("))
+  if (equal_punct(tok, '('))
   {
     Type *placeholder = calloc(1, sizeof(Type));
     Type *new_ty = abstract_declarator(&tok, tok->next, placeholder);
-    tok = skip(tok, ")");
+    tok = skip_punct(tok, ')');
     *placeholder = *type_suffix(rest, tok, ty);
     return new_ty;
   }
@@ -1064,10 +1135,10 @@ static Node *declaration(Token **rest, Token *tok)
   Node *cur = &head;
   int cnt = 0;
 
-  while (!equal(tok, ";"))
+  while (!equal_punct(tok, ';'))
   {
     if (cnt++ > 0)
-      tok = skip(tok, ",");
+      tok = skip_punct(tok, ',');
 
     Type *ty = declarator(&tok, tok, basety);
     if (ty->kind == TY_VOID)
@@ -1079,12 +1150,16 @@ static Node *declaration(Token **rest, Token *tok)
       continue;
     }
 
+    if (attr.is_tls && !attr.is_static)
+      error_tok(tok, "a _Thread_local local variable must be static");
+
     if (attr.is_static)
     {
       // static local variable
       Var *var = new_gvar(new_unique_name(), ty, true, true);
+      var->is_tls = attr.is_tls;
       push_scope(get_ident(ty->name))->var = var;
-      if (equal(tok, "="))
+      if (equal_punct(tok, '='))
         gvar_initializer(&tok, tok->next, var);
     }
     else
@@ -1093,7 +1168,7 @@ static Node *declaration(Token **rest, Token *tok)
       if (attr.align)
         var->align = attr.align;
 
-      if (equal(tok, "="))
+      if (equal_punct(tok, '='))
       {
         Node *expr = lvar_initializer(&tok, tok->next, var);
         cur = cur->next = new_unary(ND_EXPR_STMT, expr, tok);
@@ -1116,8 +1191,8 @@ static Token *skip_excess_elements(Token *tok)
 {
   while (!consume_end(&tok, tok))
   {
-    tok = skip(tok, ",");
-    if (equal(tok, "{"))
+    tok = skip_punct(tok, ',');
+    if (equal_punct(tok, '{'))
       tok = skip_excess_elements(tok->next);
     else
       assign(&tok, tok);
@@ -1130,17 +1205,17 @@ static Token *skip_end(Token *tok)
   if (consume_end(&tok, tok))
     return tok;
   warn_tok(tok, "excess elements in initializer");
-  return skip(skip_excess_elements(tok), "}");
+  return skip_punct(skip_excess_elements(tok), '}');
 }
 
 static int count_array_init_elements(Token *tok, Type *ty)
 {
-  tok = skip(tok, "{");
+  tok = skip_punct(tok, '{');
   int len = 0;
   while (!is_end(tok))
   {
     if (len++ > 0)
-      tok = skip(tok, ",");
+      tok = skip_punct(tok, ',');
     initializer(&tok, tok, ty->base);
   }
 
@@ -1155,13 +1230,13 @@ static Initializer *string_initializer(Token **rest, Token *tok, Type *ty)
   // `len` is minimum length of lhs and rhs.
   // For example, if `a[3]="ab"`, len is 2.
   // If `a[3]="abcd"', len is 5.
-  int len = (ty->array_len < tok->cont_len)
+  int len = (ty->array_len < tok->lit->cont_len)
                 ? ty->array_len
-                : tok->cont_len;
+                : tok->lit->cont_len;
 
   for (int i = 0; i < len; ++i)
   {
-    Node *expr = new_node_num(tok->contents[i], tok);
+    Node *expr = new_node_num(tok->lit->contents[i], tok);
     init->children[i] = new_init(ty->base, 0, expr, tok);
   }
 
@@ -1173,7 +1248,7 @@ static Initializer *string_initializer(Token **rest, Token *tok, Type *ty)
 //                   | initializer ("," initializer)* ","
 static Initializer *array_initializer(Token **rest, Token *tok, Type *ty)
 {
-  bool has_paren = equal(tok, "{");
+  bool has_paren = equal_punct(tok, '{');
   if (has_paren)
     tok = tok->next;
   Initializer *init = new_init(ty, ty->array_len, NULL, tok);
@@ -1181,7 +1256,7 @@ static Initializer *array_initializer(Token **rest, Token *tok, Type *ty)
   for (int i = 0; i < ty->array_len && !is_end(tok); ++i)
   {
     if (i > 0)
-      tok = skip(tok, ",");
+      tok = skip_punct(tok, ',');
     init->children[i] = initializer(&tok, tok, ty->base);
   }
   if (has_paren)
@@ -1194,7 +1269,7 @@ static Initializer *array_initializer(Token **rest, Token *tok, Type *ty)
 //                    | initializer ("," initializer)* ","
 static Initializer *struct_initializer(Token **rest, Token *tok, Type *ty)
 {
-  if (!equal(tok, "{"))
+  if (!equal_punct(tok, '{'))
   {
     Token *tok2;
     Node *expr = assign(&tok2, tok);
@@ -1218,15 +1293,15 @@ static Initializer *struct_initializer(Token **rest, Token *tok, Type *ty)
     len++;
 
   Initializer *init = new_init(ty, len, NULL, tok);
-  bool has_paren = equal(tok, "{");
+  bool has_paren = equal_punct(tok, '{');
   if (has_paren)
     tok = tok->next;
 
   int i = 0;
-  for (Member *mem = ty->members; mem && !equal(tok, "}"); mem = mem->next, i++)
+  for (Member *mem = ty->members; mem && !equal_punct(tok, '}'); mem = mem->next, i++)
   {
     if (i > 0)
-      tok = skip(tok, ",");
+      tok = skip_punct(tok, ',');
     init->children[i] = initializer(&tok, tok, mem->ty);
   }
 
@@ -1248,7 +1323,7 @@ static Initializer *initializer2(Token **rest, Token *tok, Type *ty)
     return struct_initializer(rest, tok, ty);
 
   Token *start = tok;
-  bool has_paren = equal(tok, "{");
+  bool has_paren = equal_punct(tok, '{');
   if (has_paren)
     tok = tok->next;
   Initializer *init = new_init(ty, 0, assign(&tok, tok), tok);
@@ -1269,7 +1344,7 @@ static Initializer *initializer(Token **rest, Token *tok, Type *ty)
   {
     int len;
     if (ty->base->kind == TY_CHAR && tok->kind == TK_STR)
-      len = tok->cont_len;
+      len = tok->lit->cont_len;
     else
       len = count_array_init_elements(tok, ty);
     *ty = *array_of(ty->base, len);
@@ -1356,7 +1431,7 @@ static Node *compound_stmt(Token **rest, Token *tok)
 
   enter_scope();
 
-  while (!equal(tok, "}"))
+  while (!equal_punct(tok, '}'))
   {
     if (is_typename(tok))
       cur = cur->next = declaration(&tok, tok);
@@ -1396,42 +1471,42 @@ static Node *expr_stmt(Token **rest, Token *tok)
 //      | expr ";"
 static Node *stmt(Token **rest, Token *tok)
 {
-  if (equal(tok, "return"))
+  if (tok->kind == TK_KW_RETURN)
   {
     Node *node = new_node(ND_RETURN, tok);
-    if (equal(tok->next, ";"))
+    if (equal_punct(tok->next, ';'))
     {
       *rest = tok->next->next;
       return node;
     }
 
     Node *exp = expr(&tok, tok->next);
-    *rest = skip(tok, ";");
+    *rest = skip_punct(tok, ';');
 
     add_type(exp);
     node->lhs = new_cast(exp, current_fn->ty->return_ty);
     return node;
   }
 
-  if (equal(tok, "if"))
+  if (tok->kind == TK_KW_IF)
   {
     Node *node = new_node(ND_IF, tok);
-    tok = skip(tok->next, "(");
+    tok = skip_punct(tok->next, '(');
     node->cond = expr(&tok, tok);
-    tok = skip(tok, ")");
+    tok = skip_punct(tok, ')');
     node->then = stmt(&tok, tok);
-    if (equal(tok, "else"))
+    if (tok->kind == TK_KW_ELSE)
       node->els = stmt(&tok, tok->next);
     *rest = tok;
     return node;
   }
 
-  if (equal(tok, "switch"))
+  if (tok->kind == TK_KW_SWITCH)
   {
     Node *node = new_node(ND_SWITCH, tok);
-    tok = skip(tok->next, "(");
+    tok = skip_punct(tok->next, '(');
     node->cond = expr(&tok, tok);
-    tok = skip(tok, ")");
+    tok = skip_punct(tok, ')');
 
     Node *sw = current_switch;
     current_switch = node;
@@ -1440,14 +1515,14 @@ static Node *stmt(Token **rest, Token *tok)
     return node;
   }
 
-  if (equal(tok, "case"))
+  if (tok->kind == TK_KW_CASE)
   {
     if (!current_switch)
       error_tok(tok, "stray case");
 
     Node *node = new_node(ND_CASE, tok);
     int val = const_expr(&tok, tok->next);
-    tok = skip(tok, ":");
+    tok = skip_punct(tok, ':');
     node->lhs = stmt(rest, tok);
     node->val = val;
     node->case_next = current_switch->case_next;
@@ -1455,28 +1530,28 @@ static Node *stmt(Token **rest, Token *tok)
     return node;
   }
 
-  if (equal(tok, "default"))
+  if (tok->kind == TK_KW_DEFAULT)
   {
     if (!current_switch)
       error_tok(tok, "stray default");
 
     Node *node = new_node(ND_CASE, tok);
-    tok = skip(tok->next, ":");
+    tok = skip_punct(tok->next, ':');
     node->lhs = stmt(rest, tok);
     current_switch->default_case = node;
     return node;
   }
 
-  if (equal(tok, "while"))
+  if (tok->kind == TK_KW_WHILE)
   {
     Node *node = new_node(ND_WHILE, tok);
-    tok = skip(tok->next, "(");
+    tok = skip_punct(tok->next, '(');
     node->cond = expr(&tok, tok);
-    tok = skip(tok, ")");
+    tok = skip_punct(tok, ')');
 
-    if (equal(tok, ";"))
+    if (equal_punct(tok, ';'))
     {
-      *rest = skip(tok, ";");
+      *rest = skip_punct(tok, ';');
       return node;
     }
 
@@ -1485,22 +1560,22 @@ static Node *stmt(Token **rest, Token *tok)
     return node;
   }
 
-  if (equal(tok, "do"))
+  if (tok->kind == TK_KW_DO)
   {
     Node *node = new_node(ND_DO, tok);
     node->then = stmt(&tok, tok->next);
     tok = skip(tok, "while");
-    tok = skip(tok, "(");
+    tok = skip_punct(tok, '(');
     node->cond = expr(&tok, tok);
-    tok = skip(tok, ")");
-    *rest = skip(tok, ";");
+    tok = skip_punct(tok, ')');
+    *rest = skip_punct(tok, ';');
     return node;
   }
 
-  if (equal(tok, "for"))
+  if (tok->kind == TK_KW_FOR)
   {
     Node *node = new_node(ND_FOR, tok);
-    tok = skip(tok->next, "(");
+    tok = skip_punct(tok->next, '(');
 
     enter_scope();
 
@@ -1510,23 +1585,23 @@ static Node *stmt(Token **rest, Token *tok)
     }
     else
     {
-      if (!equal(tok, ";"))
+      if (!equal_punct(tok, ';'))
         node->init = expr_stmt(&tok, tok);
-      tok = skip(tok, ";");
+      tok = skip_punct(tok, ';');
     }
 
     // For "for (a; b; c) {...}" we regard b as true if b is empty.
     node->cond = new_node_num(1, tok);
-    if (!equal(tok, ";"))
+    if (!equal_punct(tok, ';'))
       node->cond = expr(&tok, tok);
-    tok = skip(tok, ";");
+    tok = skip_punct(tok, ';');
 
-    if (!equal(tok, ")"))
+    if (!equal_punct(tok, ')'))
       node->inc = expr_stmt(&tok, tok);
-    tok = skip(tok, ")");
+    tok = skip_punct(tok, ')');
 
-    if (equal(tok, ";"))
-      tok = skip(tok, ";");
+    if (equal_punct(tok, ';'))
+      tok = skip_punct(tok, ';');
     else
       node->then = stmt(&tok, tok);
 
@@ -1535,39 +1610,39 @@ static Node *stmt(Token **rest, Token *tok)
     return node;
   }
 
-  if (equal(tok, "break"))
+  if (tok->kind == TK_KW_BREAK)
   {
-    *rest = skip(tok->next, ";");
+    *rest = skip_punct(tok->next, ';');
     return new_node(ND_BREAK, tok);
   }
 
-  if (equal(tok, "continue"))
+  if (tok->kind == TK_KW_CONTINUE)
   {
-    *rest = skip(tok->next, ";");
+    *rest = skip_punct(tok->next, ';');
     return new_node(ND_CONTINUE, tok);
   }
 
-  if (equal(tok, "goto"))
+  if (tok->kind == TK_KW_GOTO)
   {
     Node *node = new_node(ND_GOTO, tok);
     node->label_name = get_ident(tok->next);
-    *rest = skip(tok->next->next, ";");
+    *rest = skip_punct(tok->next->next, ';');
     return node;
   }
 
-  if (tok->kind == TK_IDENT && equal(tok->next, ":"))
+  if (tok->kind == TK_IDENT && equal_punct(tok->next, ':'))
   {
     Node *node = new_node(ND_LABEL, tok);
-    node->label_name = strndup(tok->loc, tok->len);
+    node->label_name = tok->ident;
     node->lhs = stmt(rest, tok->next->next);
     return node;
   }
 
-  if (equal(tok, "{"))
+  if (equal_punct(tok, '{'))
     return compound_stmt(rest, tok->next);
 
   Node *node = expr_stmt(&tok, tok);
-  *rest = skip(tok, ";");
+  *rest = skip_punct(tok, ';');
   return node;
 }
 
@@ -1576,7 +1651,7 @@ static Node *expr(Token **rest, Token *tok)
 {
   Node *node = assign(&tok, tok);
 
-  if (equal(tok, ","))
+  if (equal_punct(tok, ','))
     return new_binary(ND_COMMA, node, expr(rest, tok->next), tok);
 
   *rest = tok;
@@ -1793,40 +1868,40 @@ static Node *assign(Token **rest, Token *tok)
 {
   Node *node = conditional(&tok, tok);
 
-  if (equal(tok, "="))
+  if (tok->punct == '=')
   {
     Node *rhs = assign(&tok, tok->next);
     node = new_binary(ND_ASSIGN, node, rhs, tok);
   }
 
-  if (equal(tok, "+="))
+  if (tok->punct == PUNCT_ADD_ASSIGN)
     return to_assign(new_add(node, assign(rest, tok->next), tok));
 
-  if (equal(tok, "-="))
+  if (tok->punct == PUNCT_SUB_ASSIGN)
     return to_assign(new_sub(node, assign(rest, tok->next), tok));
 
-  if (equal(tok, "*="))
+  if (tok->punct == PUNCT_MUL_ASSIGN)
     return to_assign(new_binary(ND_MUL, node, assign(rest, tok->next), tok));
 
-  if (equal(tok, "/="))
+  if (tok->punct == PUNCT_DIV_ASSIGN)
     return to_assign(new_binary(ND_DIV, node, assign(rest, tok->next), tok));
 
-  if (equal(tok, "%="))
+  if (tok->punct == PUNCT_MOD_ASSIGN)
     return to_assign(new_binary(ND_MOD, node, assign(rest, tok->next), tok));
 
-  if (equal(tok, "&="))
+  if (tok->punct == PUNCT_AND_ASSIGN)
     return to_assign(new_binary(ND_BITAND, node, assign(rest, tok->next), tok));
 
-  if (equal(tok, "|="))
+  if (tok->punct == PUNCT_OR_ASSIGN)
     return to_assign(new_binary(ND_BITOR, node, assign(rest, tok->next), tok));
 
-  if (equal(tok, "^="))
+  if (tok->punct == PUNCT_XOR_ASSIGN)
     return to_assign(new_binary(ND_BITXOR, node, assign(rest, tok->next), tok));
 
-  if (equal(tok, "<<="))
+  if (tok->punct == PUNCT_SHL_ASSIGN)
     return to_assign(new_binary(ND_SHL, node, assign(rest, tok->next), tok));
 
-  if (equal(tok, ">>="))
+  if (tok->punct == PUNCT_SHR_ASSIGN)
     return to_assign(new_binary(ND_SHR, node, assign(rest, tok->next), tok));
 
   *rest = tok;
@@ -1838,12 +1913,12 @@ static Node *conditional(Token **rest, Token *tok)
 {
   Node *node = logor(&tok, tok);
 
-  if (equal(tok, "?"))
+  if (tok->punct == '?')
   {
     Node *cond = new_node(ND_COND, tok);
     cond->cond = node;
     cond->then = expr(&tok, tok->next);
-    tok = skip(tok, ":");
+    tok = skip_punct(tok, ':');
     cond->els = conditional(rest, tok);
     return cond;
   }
@@ -1858,7 +1933,7 @@ static Node *conditional(Token **rest, Token *tok)
 static Node *logor(Token **rest, Token *tok)
 {
   Node *node = logand(&tok, tok);
-  while (equal(tok, "||"))
+  while (tok->punct == PUNCT_LOGOR)
   {
     Token *start = tok;
     node = new_binary(ND_LOGOR, node, logand(&tok, tok->next), start);
@@ -1871,7 +1946,7 @@ static Node *logor(Token **rest, Token *tok)
 static Node *logand(Token **rest, Token *tok)
 {
   Node *node = bitor (&tok, tok);
-  while (equal(tok, "&&"))
+  while (tok->punct == PUNCT_LOGAND)
   {
     Token *start = tok;
     node = new_binary(ND_LOGAND, node, bitor (&tok, tok->next), start);
@@ -1884,7 +1959,7 @@ static Node *logand(Token **rest, Token *tok)
 static Node * bitor (Token * *rest, Token *tok)
 {
   Node *node = bitxor(&tok, tok);
-  while (equal(tok, "|"))
+  while (tok->punct == '|')
   {
     Token *start = tok;
     node = new_binary(ND_BITOR, node, bitxor(&tok, tok->next), start);
@@ -1897,7 +1972,7 @@ static Node * bitor (Token * *rest, Token *tok)
 static Node *bitxor(Token **rest, Token *tok)
 {
   Node *node = bitand(&tok, tok);
-  while (equal(tok, "^"))
+  while (tok->punct == '^')
   {
     Token *start = tok;
     node = new_binary(ND_BITXOR, node, bitand(&tok, tok->next), start);
@@ -1910,7 +1985,7 @@ static Node *bitxor(Token **rest, Token *tok)
 static Node *bitand(Token **rest, Token *tok)
 {
   Node *node = equality(&tok, tok);
-  while (equal(tok, "&"))
+  while (tok->punct == '&')
   {
     Token *start = tok;
     node = new_binary(ND_BITAND, node, equality(&tok, tok->next), start);
@@ -1926,13 +2001,13 @@ static Node *equality(Token **rest, Token *tok)
 
   for (;;)
   {
-    if (equal(tok, "=="))
+    if (tok->punct == PUNCT_EQ)
     {
       Node *rhs = relational(&tok, tok->next);
       node = new_binary(ND_EQ, node, rhs, tok);
       continue;
     }
-    else if (equal(tok, "!="))
+    else if (tok->punct == PUNCT_NE)
     {
       Node *rhs = relational(&tok, tok->next);
       node = new_binary(ND_NE, node, rhs, tok);
@@ -1950,28 +2025,28 @@ static Node *relational(Token **rest, Token *tok)
 
   for (;;)
   {
-    if (equal(tok, "<"))
+    if (tok->punct == '<')
     {
       Node *rhs = shift(&tok, tok->next);
       node = new_binary(ND_LT, node, rhs, tok);
       continue;
     }
 
-    if (equal(tok, "<="))
+    if (tok->punct == PUNCT_LE)
     {
       Node *rhs = shift(&tok, tok->next);
       node = new_binary(ND_LE, node, rhs, tok);
       continue;
     }
 
-    if (equal(tok, ">"))
+    if (tok->punct == '>')
     {
       Node *rhs = shift(&tok, tok->next);
       node = new_binary(ND_LT, rhs, node, tok);
       continue;
     }
 
-    if (equal(tok, ">="))
+    if (tok->punct == PUNCT_GE)
     {
       Node *rhs = shift(&tok, tok->next);
       node = new_binary(ND_LE, rhs, node, tok);
@@ -1992,13 +2067,13 @@ static Node *shift(Token **rest, Token *tok)
   {
     Token *start = tok;
 
-    if (equal(tok, "<<"))
+    if (tok->punct == PUNCT_SHL)
     {
       node = new_binary(ND_SHL, node, add(&tok, tok->next), start);
       continue;
     }
 
-    if (equal(tok, ">>"))
+    if (tok->punct == PUNCT_SHR)
     {
       node = new_binary(ND_SHR, node, add(&tok, tok->next), start);
       continue;
@@ -2016,7 +2091,7 @@ static Node *add(Token **rest, Token *tok)
 
   for (;;)
   {
-    if (equal(tok, "+"))
+    if (tok->punct == '+')
     {
       Node *rhs = mul(&tok, tok->next);
       // node = new_node_binary(ND_ADD, node, rhs, tok);
@@ -2024,7 +2099,7 @@ static Node *add(Token **rest, Token *tok)
       continue;
     }
 
-    if (equal(tok, "-"))
+    if (tok->punct == '-')
     {
       Node *rhs = mul(&tok, tok->next);
       // node = new_node_binary(ND_SUB, node, rhs, tok);
@@ -2044,21 +2119,21 @@ static Node *mul(Token **rest, Token *tok)
 
   for (;;)
   {
-    if (equal(tok, "*"))
+    if (tok->punct == '*')
     {
       Node *rhs = cast(&tok, tok->next);
       node = new_binary(ND_MUL, node, rhs, tok);
       continue;
     }
 
-    if (equal(tok, "/"))
+    if (tok->punct == '/')
     {
       Node *rhs = cast(&tok, tok->next);
       node = new_binary(ND_DIV, node, rhs, tok);
       continue;
     }
 
-    if (equal(tok, "%"))
+    if (tok->punct == '%')
     {
       Node *rhs = cast(&tok, tok->next);
       node = new_binary(ND_MOD, node, rhs, tok);
@@ -2091,13 +2166,13 @@ static Node *compound_literal(Token **rest, Token *tok, Type *ty, Token *start)
 //      | unary
 static Node *cast(Token **rest, Token *tok)
 {
-  if (equal(tok, "(") && is_typename(tok->next))
+  if (equal_punct(tok, '(') && is_typename(tok->next))
   {
     Token *start = tok;
     Type *ty = typename(&tok, tok->next);
-    tok = skip(tok, ")");
+    tok = skip_punct(tok, ')');
 
-    if (equal(tok, "{"))
+    if (equal_punct(tok, '{'))
       return compound_literal(rest, tok, ty, start);
 
     Node *node = new_unary(ND_CAST, cast(rest, tok), start);
@@ -2116,46 +2191,46 @@ static Node *cast(Token **rest, Token *tok)
 //       | postfix
 static Node *unary(Token **rest, Token *tok)
 {
-  if (equal(tok, "sizeof") && equal(tok->next, "(") &&
+  if (tok->kind == TK_KW_SIZEOF && equal_punct(tok->next, '(') &&
       is_typename(tok->next->next))
   {
     Type *ty = typename(&tok, tok->next->next);
-    *rest = skip(tok, ")");
+    *rest = skip_punct(tok, ')');
     return new_node_ulong(size_of(ty), tok);
   }
-  if (equal(tok, "sizeof"))
+  if (tok->kind == TK_KW_SIZEOF)
   {
     Node *node = cast(rest, tok->next);
     add_type(node);
     return new_node_ulong(size_of(node->ty), tok);
   }
-  if (equal(tok, "_Alignof"))
+  if (tok->kind == TK_KW_ALIGNOF)
   {
-    tok = skip(tok->next, "(");
+    tok = skip_punct(tok->next, '(');
     Type *ty = typename(&tok, tok);
-    *rest = skip(tok, ")");
+    *rest = skip_punct(tok, ')');
     return new_node_ulong(ty->align, tok);
   }
-  if (equal(tok, "+"))
+  if (tok->punct == '+')
     return cast(rest, tok->next);
-  if (equal(tok, "-"))
+  if (tok->punct == '-')
     return new_binary(ND_SUB, new_node_num(0, tok), cast(rest, tok->next), tok);
-  if (equal(tok, "*"))
+  if (tok->punct == '*')
     return new_unary(ND_DEREF, cast(rest, tok->next), tok);
-  if (equal(tok, "&"))
+  if (tok->punct == '&')
     return new_unary(ND_ADDR, cast(rest, tok->next), tok);
 
-  if (equal(tok, "!"))
+  if (tok->punct == '!')
     return new_unary(ND_NOT, cast(rest, tok->next), tok);
 
-  if (equal(tok, "~"))
+  if (tok->punct == '~')
     return new_unary(ND_BITNOT, cast(rest, tok->next), tok);
 
   // Read ++i as i+=1
-  if (equal(tok, "++"))
+  if (tok->punct == PUNCT_INC)
     return to_assign(new_add(unary(rest, tok->next), new_node_num(1, tok), tok));
   // Read --i as i-=1
-  if (equal(tok, "--"))
+  if (tok->punct == PUNCT_DEC)
     return to_assign(new_sub(unary(rest, tok->next), new_node_num(1, tok), tok));
 
   return postfix(rest, tok);
@@ -2167,23 +2242,23 @@ static Member *struct_members(Token **rest, Token *tok)
   Member head = {};
   Member *cur = &head;
 
-  while (!equal(tok, "}"))
+  while (!equal_punct(tok, '}'))
   {
     VarAttr attr = {};
     Type *basety = typespec(&tok, tok, &attr);
     int cnt = 0;
 
-    while (!equal(tok, ";"))
+    while (!equal_punct(tok, ';'))
     {
       if (cnt++)
-        tok = skip(tok, ",");
+        tok = skip_punct(tok, ',');
 
       Member *mem = calloc(1, sizeof(Member));
       mem->ty = declarator(&tok, tok, basety);
       mem->name = mem->ty->name;
       mem->align = attr.align ? attr.align : mem->ty->align;
 
-      if (equal(tok, ":"))
+      if (equal_punct(tok, ':'))
       {
         tok = tok->next;
         mem->is_bitfield = true;
@@ -2194,6 +2269,11 @@ static Member *struct_members(Token **rest, Token *tok)
     tok = tok->next;
   }
 
+  // If the last element is an array of incomplete type, it's
+  // a flexible array member. It has no size.
+  if (cur != &head && cur->ty->kind == TY_ARR && cur->ty->array_len < 0)
+    cur->ty = array_of(cur->ty->base, 0);
+
   *rest = tok->next;
   return head.next;
 }
@@ -2209,7 +2289,7 @@ static Type *struct_union_decl(Token **rest, Token *tok)
     tok = tok->next;
   }
 
-  if (tag && !equal(tok, "{"))
+  if (tag && !equal_punct(tok, '{'))
   {
     *rest = tok;
 
@@ -2223,7 +2303,7 @@ static Type *struct_union_decl(Token **rest, Token *tok)
     return ty;
   }
 
-  tok = skip(tok, "{");
+  tok = skip_punct(tok, '{');
 
   // Construct a struct object.
   Type *ty = struct_type();
@@ -2300,8 +2380,7 @@ static Type *union_decl(Token **rest, Token *tok)
 static Member *get_struct_member(Type *ty, Token *tok)
 {
   for (Member *mem = ty->members; mem; mem = mem->next)
-    if (mem->name->len == tok->len &&
-        !strncmp(mem->name->loc, tok->loc, tok->len))
+    if (mem->name->ident == tok->ident)
       return mem;
   error_tok(tok, "no such member");
 }
@@ -2351,30 +2430,30 @@ static Node *postfix(Token **rest, Token *tok)
 
   for (;;)
   {
-    if (equal(tok, "("))
+    if (tok->punct == '(')
     {
       node = funcall(&tok, tok->next, node);
       continue;
     }
 
-    if (equal(tok, "["))
+    if (tok->punct == '[')
     {
       // x[y] is short for *(x + y)
       Token *start = tok;
       Node *idx = expr(&tok, tok->next);
-      tok = skip(tok, "]");
+      tok = skip_punct(tok, ']');
       node = new_unary(ND_DEREF, new_add(node, idx, start), start);
       continue;
     }
 
-    if (equal(tok, "."))
+    if (tok->punct == '.')
     {
       node = struct_ref(node, tok->next);
       tok = tok->next->next;
       continue;
     }
 
-    if (equal(tok, "->"))
+    if (tok->punct == PUNCT_ARROW)
     {
       // x->y is short for (*x).y
       node = new_unary(ND_DEREF, node, tok);
@@ -2383,14 +2462,14 @@ static Node *postfix(Token **rest, Token *tok)
       continue;
     }
 
-    if (equal(tok, "++"))
+    if (tok->punct == PUNCT_INC)
     {
       node = new_inc_dec(node, tok, 1);
       tok = tok->next;
       continue;
     }
 
-    if (equal(tok, "--"))
+    if (tok->punct == PUNCT_DEC)
     {
       node = new_inc_dec(node, tok, -1);
       tok = tok->next;
@@ -2420,10 +2499,10 @@ static Node *funcall(Token **rest, Token *tok, Node *fn)
   Type *ty = (fn->ty->kind == TY_FUNC) ? fn->ty : fn->ty->base;
   Type *param_ty = ty->params;
 
-  while (!equal(tok, ")"))
+  while (!equal_punct(tok, ')'))
   {
     if (nargs)
-      tok = skip(tok, ",");
+      tok = skip_punct(tok, ',');
 
     Node *arg = assign(&tok, tok);
     add_type(arg);
@@ -2447,7 +2526,7 @@ static Node *funcall(Token **rest, Token *tok, Node *fn)
     node = new_binary(ND_COMMA, node, expr, tok);
   }
 
-  *rest = skip(tok, ")");
+  *rest = skip_punct(tok, ')');
 
   Node *funcall = new_unary(ND_FUNCALL, fn, tok);
   funcall->func_ty = ty;
@@ -2467,14 +2546,14 @@ static Node *funcall(Token **rest, Token *tok, Node *fn)
 // args = (expr ",")*  expr
 static Node *primary(Token **rest, Token *tok)
 {
-  if (equal(tok, "(") && equal(tok->next, "{"))
+  if (equal_punct(tok, '(') && equal_punct(tok->next, '{'))
   {
     // This is a GNU statement expression.
     Node *node = new_node(ND_STMT_EXPR, tok);
     Node head = {};
     Node *cur = &head;
     node->body = compound_stmt(&tok, tok->next->next)->body;
-    *rest = skip(tok, ")");
+    *rest = skip_punct(tok, ')');
 
     cur = node->body;
     while (cur->next)
@@ -2485,10 +2564,10 @@ static Node *primary(Token **rest, Token *tok)
     return node;
   }
 
-  if (equal(tok, "("))
+  if (equal_punct(tok, '('))
   {
     Node *node = expr(&tok, tok->next);
-    *rest = skip(tok, ")");
+    *rest = skip_punct(tok, ')');
     return node;
   }
 
@@ -2505,11 +2584,10 @@ static Node *primary(Token **rest, Token *tok)
         return new_node_num(sc->enum_val, tok);
     }
 
-    if (equal(tok->next, "("))
+    if (equal_punct(tok->next, '('))
     {
       warn_tok(tok, "implicit declaration of a function");
-      char *name = strndup(tok->loc, tok->len);
-      Var *var = new_gvar(name, func_type(int_type), true, false);
+      Var *var = new_gvar(tok->ident, func_type(int_type), true, false);
       return new_node_var(var, tok);
     }
 
@@ -2519,7 +2597,7 @@ static Node *primary(Token **rest, Token *tok)
   // String literal
   if (tok->kind == TK_STR)
   {
-    Var *var = new_string_literal(tok->contents, tok->cont_len);
+    Var *var = new_string_literal(tok->lit->contents, tok->lit->cont_len);
     *rest = tok->next;
     return new_node_var(var, tok);
   }
@@ -2530,13 +2608,13 @@ static Node *primary(Token **rest, Token *tok)
 
   *rest = tok->next;
   Node *node;
-  if (is_flonum(tok->ty))
+  if (is_flonum(tok->lit->ty))
   {
     node = new_node(ND_NUM, tok);
-    node->fval = tok->fval;
+    node->fval = tok->lit->fval;
   }
   else
     node = new_node_num(get_number(tok), tok);
-  node->ty = tok->ty;
+  node->ty = tok->lit->ty;
   return node;
 }
@@ -28,11 +28,9 @@ struct Macro
 {
   char *name;
   Token *body;
-  Macro *next;
   bool is_objlike; // Object-like or function-like
   MacroParam *params;
   bool is_variadic;
-  bool deleted;
   macro_handler_fn *handler;
 };
 
@@ -56,13 +54,25 @@ struct CondIncl
 static Token *preprocess2(Token *tok);
 static Token *copy_line(Token **rest, Token *tok);
 static Token *new_eof(Token *tok);
-static Macro *find_macro(Token *tok, Macro *macros);
+static Macro *find_macro(Token *tok);
 
 char **dependencies; // for -MD option
-Macro *macros = NULL;
+
+// Defined macros by their names. #undef removes a macro from it.
+static HashMap macros;
 
 static CondIncl *cond_incl;
 
+// Files with `#pragma once`, and the guard macros of files wrapped
+// in `#ifndef X ... #endif`, by their canonical paths. Including
+// them again is skipped before the file is read.
+static HashMap pragma_once;
+static HashMap include_guards;
+
+// The `#ifndef` whose `#endif` was the last line of a file, if it
+// had no `#elif` or `#else`.
+static Token *guard_end;
+
 bool find_from_str_array(char **str_arr, char *target)
 {
   if (!str_arr)
@@ -145,15 +155,11 @@ static char *concat(char *s1, char *s2)
   return s;
 }
 
-static Token *undef_macro(Token *tok, Macro **macros)
+static Token *read_undef(Token *tok)
 {
   if (tok->kind != TK_IDENT)
     error_tok(tok, "expected an identifier");
-  Macro *m = calloc(1, sizeof(Macro));
-  m->name = strndup(tok->loc, tok->len);
-  m->next = *macros;
-  m->deleted = true;
-  *macros = m;
+  hashmap_delete(&macros, tok->ident);
 
   while (!tok->at_bol)
     tok = tok->next;
@@ -166,23 +172,23 @@ static MacroParam *read_macro_params(Token **rest, Token *tok, bool *is_variadic
   MacroParam head = {};
   MacroParam *cur = &head;
 
-  while (!equal(tok, ")"))
+  while (!equal_punct(tok, ')'))
   {
     if (cur != &head)
-      tok = skip(tok, ",");
+      tok = skip_punct(tok, ',');
     
-    if (equal(tok, "..."))
+    if (equal_punct(tok, PUNCT_ELLIPSIS))
     {
       *is_variadic = true;
       tok = tok->next;
-      skip(tok, ")");
+      skip_punct(tok, ')');
       break;
     }
 
     if (tok->kind != TK_IDENT)
       error_tok(tok, "expected an identifier");
     MacroParam *m = calloc(1, sizeof(MacroParam));
-    m->name = strndup(tok->loc, tok->len);
+    m->name = tok->ident;
     cur = cur->next = m;
     tok = tok->next;
   }
@@ -190,16 +196,16 @@ static MacroParam *read_macro_params(Token **rest, Token *tok, bool *is_variadic
   return head.next;
 }
 
-static Token *push_macro(Token *tok, Macro **macros)
+static Token *push_macro(Token *tok)
 {
   if (tok->kind != TK_IDENT)
     error_tok(tok, "expected an identifier");
   Macro *m = calloc(1, sizeof(Macro));
-  m->name = strndup(tok->loc, tok->len);
+  m->name = tok->ident;
 
   tok = tok->next;
 
-  if (!tok->has_space && equal(tok, "("))
+  if (!tok->has_space && equal_punct(tok, '('))
   {
     // Function-like macro
     bool is_variadic = false;
@@ -215,23 +221,16 @@ static Token *push_macro(Token *tok, Macro **macros)
   }
 
   m->body = copy_line(&tok, tok);
-  m->next = *macros;
-  *macros = m;
+  hashmap_put(&macros, m->name, m);
 
   return tok;
 }
 
-static Macro *find_macro(Token *tok, Macro *macros)
+static Macro *find_macro(Token *tok)
 {
-  char *name = strndup(tok->loc, tok->len);
-  Macro *m = macros;
-  while (m)
-  {
-    if (!strcmp(name, m->name))
-      return m->deleted ? NULL : m;
-    m = m->next;
-  }
-  return NULL;
+  if (tok->kind != TK_IDENT)
+    return NULL;
+  return hashmap_get2(&macros, tok->ident, tok->len);
 }
 
 // Duplicate macro body
@@ -299,9 +298,9 @@ static Hideset *hideset_union(Hideset *hs1, Hideset *hs2) {
   return head.next;
 }
 
-static bool hideset_contains(Hideset *hs, char *s, int len) {
+static bool hideset_contains(Hideset *hs, char *name) {
   for (; hs; hs = hs->next)
-    if (strlen(hs->name) == len && !strncmp(hs->name, s, len))
+    if (hs->name == name)
       return true;
   return false;
 }
@@ -325,7 +324,7 @@ static Hideset *hideset_intersection(Hideset *hs1, Hideset *hs2)
 
   for (; hs1; hs1 = hs1->next)
   {
-    if (hideset_contains(hs2, hs1->name, strlen(hs1->name)))
+    if (hideset_contains(hs2, hs1->name))
       cur = cur->next = new_hideset(hs1->name);
   }
   return head.next;
@@ -339,24 +338,29 @@ static MacroArg *read_macro_arg_one(Token **rest, Token *tok, bool read_rest)
 
   for (;;)
   {
-    if (level == 0 && equal(tok, ")"))
+    if (level == 0 && equal_punct(tok, ')'))
       break;
-    if (level == 0 && !read_rest && equal(tok, ","))
+    if (level == 0 && !read_rest && equal_punct(tok, ','))
       break;
 
+    if (tok->kind == TK_LAZY)
+    {
+      resume_tokenize(tok);
+      continue;
+    }
     if (tok->kind == TK_EOF)
       error_tok(tok, "premature end of input");
     
-    if (equal(tok, "("))
+    if (equal_punct(tok, '('))
       level++;
-    else if (equal(tok, ")"))
+    else if (equal_punct(tok, ')'))
       level--;
 
     cur = cur->next = copy_token(tok);
     tok = tok->next;
   }
 
-  bool is_last = equal(tok, ")");
+  bool is_last = equal_punct(tok, ')');
 
   cur->next = new_eof(tok);
 
@@ -386,7 +390,7 @@ static MacroArg *read_macro_args(Token **rest, Token *tok,
   for (; pp && !cur->is_last ; pp = pp->next)
   {
     if (cur != &head)
-      tok = skip(tok, ",");
+      tok = skip_punct(tok, ',');
     cur = cur->next = read_macro_arg_one(&tok, tok, false);
     cur->name = pp->name;
   }
@@ -394,14 +398,14 @@ static MacroArg *read_macro_args(Token **rest, Token *tok,
   if (is_variadic)
   {
     if (pp != params)
-      tok = skip(tok, ",");
+      tok = skip_punct(tok, ',');
     cur = cur->next = read_macro_arg_one(&tok, tok, true);
-    cur->name = "__VA_ARGS__";
+    cur->name = intern("__VA_ARGS__", 11);
   }
   else if (pp)
     error_tok(start, "too many arguments");
 
-  skip(tok, ")");
+  skip_punct(tok, ')');
   *rest = tok;
   return head.next;
 }
@@ -410,7 +414,7 @@ static Token *find_arg(MacroArg *args, Token *tok)
 {
   for (MacroArg *ap = args; ap; ap = ap->next)
   {
-    if (tok->len == strlen(ap->name) && !strncmp(tok->loc, ap->name, tok->len))
+    if (tok->ident == ap->name)
       return ap->tok;
   }
   return NULL;
@@ -499,8 +503,11 @@ static Token *stringize(Token *arg)
   tok->loc = buf;
   tok->len = len - 1;
   tok->kind = TK_STR;
-  tok->contents = buf2;
-  tok->cont_len = len2 + 1; // tok->cont_len count trailing '\0'
+  tok->punct = 0;
+  tok->ident = NULL;
+  tok->lit = calloc(1, sizeof(Literal));
+  tok->lit->contents = buf2;
+  tok->lit->cont_len = len2; // len2 counts the trailing '\0'
   return tok;
   
 }
@@ -512,7 +519,8 @@ static Token *paste(Token *lhs, Token *rhs)
   sprintf(buf, "%.*s%.*s", lhs->len, lhs->loc, rhs->len, rhs->loc);
 
   // Tokenize the resulting string.
-  Token *tok = tokenize(lhs->filename, lhs->file_no, buf);
+  SourceFile *file = tok_file(lhs);
+  Token *tok = tokenize(file->name, file->file_no, buf);
   if (tok->next->kind != TK_EOF)
     error_tok(lhs, "pasting forms '%s', an invalid token", buf);
   tok->at_bol = false;
@@ -529,7 +537,7 @@ static Token *subst(Token *tok, MacroArg *args)
   {
     // # operator (stringizing operator)
     // "#" followed by a parameter is replaced with stringized actual.
-    if (equal(tok, "#"))
+    if (equal_punct(tok, '#'))
     {
       Token *arg = find_arg(args, tok->next);
       if (!arg)
@@ -542,7 +550,7 @@ static Token *subst(Token *tok, MacroArg *args)
 
     // ## operator (token-pasting operator)
     // x##y is replaced with xy.
-    if (equal(tok->next, "##"))
+    if (equal_punct(tok->next, PUNCT_HASHHASH))
     {
       Token *x = tok;
       Token *y = tok->next->next;
@@ -616,10 +624,10 @@ static bool expand_macro(Token **new_tok, Token *tok)
 {
   if (tok->kind == TK_IDENT)
   {
-    if (hideset_contains(tok->hideset, tok->loc, tok->len))
+    if (hideset_contains(tok->hideset, tok->ident))
       return false;
     
-    Macro *m = find_macro(tok, macros);
+    Macro *m = find_macro(tok);
     if (!m)
     {
       *new_tok = tok;
@@ -646,7 +654,11 @@ static bool expand_macro(Token **new_tok, Token *tok)
 
     // Function-like macro
 
-    if (!equal(tok->next, "("))
+    // The argument list may start on a line not tokenized yet. A batch
+    // of lines may have no tokens at all, e.g. if they are blank.
+    while (tok->next->kind == TK_LAZY)
+      resume_tokenize(tok->next);
+    if (!equal_punct(tok->next, '('))
       return false;
     
     // If a funclike macro token is not followed by an argument list,
@@ -677,8 +689,11 @@ static Token *new_eof(Token *tok)
 {
   Token *t = copy_token(tok);
   t->kind = TK_EOF;
+  t->punct = 0;
+  t->ident = NULL;
   t->len = 0;
   t->at_bol = true;
+  t->next = NULL;
   return t;
 }
 
@@ -686,14 +701,20 @@ static Token *skip_cond_incl2(Token *tok)
 {
   while (tok->kind != TK_EOF)
   {
-    if (equal(tok, "#") && (equal(tok->next, "if") ||
+    if (tok->kind == TK_LAZY)
+    {
+      skip_inactive(tok);
+      continue;
+    }
+
+    if (equal_punct(tok, '#') && (equal(tok->next, "if") ||
         equal(tok->next, "ifdef") || equal(tok->next, "ifndef")))
     {
       tok = skip_cond_incl2(tok->next->next);
       continue;
     }
 
-    if (equal(tok, "#") && equal(tok->next, "endif"))
+    if (equal_punct(tok, '#') && equal(tok->next, "endif"))
       return tok->next->next;
     
     tok = tok->next;
@@ -707,13 +728,21 @@ static Token *skip_cond_incl(Token *tok)
 {
   while (tok->kind != TK_EOF)
   {
-    if (equal(tok, "#") && (equal(tok->next, "if") ||
+    // The lines that are not tokenized yet are skipped without
+    // tokenizing them.
+    if (tok->kind == TK_LAZY)
+    {
+      skip_inactive(tok);
+      continue;
+    }
+
+    if (equal_punct(tok, '#') && (equal(tok->next, "if") ||
         equal(tok->next, "ifdef") || equal(tok->next, "ifndef")))
     {
       tok = skip_cond_incl2(tok->next->next);
       continue;
     }
-    if (equal(tok, "#") && ( equal(tok->next, "elif")
+    if (equal_punct(tok, '#') && ( equal(tok->next, "elif")
         || equal(tok->next, "else") || equal(tok->next, "endif")))
       break;
     tok = tok->next;
@@ -765,14 +794,16 @@ static char *quote_string(char *str)
 static Token *new_str_token(char *str, Token *tmpl)
 {
   char *buf = quote_string(str);
-  return tokenize(tmpl->filename, tmpl->file_no, buf);
+  SourceFile *file = tok_file(tmpl);
+  return tokenize(file->name, file->file_no, buf);
 }
 
 static Token *new_num_token(int val, Token *tmpl)
 {
   char *buf = calloc(1, 30);
   sprintf(buf, "%d\n", val);
-  return tokenize(tmpl->filename, tmpl->file_no, buf);
+  SourceFile *file = tok_file(tmpl);
+  return tokenize(file->name, file->file_no, buf);
 }
 
 static Token *read_const_expr(Token **rest, Token *tok)
@@ -791,7 +822,7 @@ static Token *read_const_expr(Token **rest, Token *tok)
     if (equal(tok, "defined"))
     {
       Token *start = tok;
-      bool has_paren = equal(tok->next, "(");
+      bool has_paren = equal_punct(tok->next, '(');
       if (has_paren)
         tok = tok->next->next;
       else
@@ -799,11 +830,11 @@ static Token *read_const_expr(Token **rest, Token *tok)
       
       if (tok->kind != TK_IDENT)
         error_tok(start, "macro name must be an identifier");
-      Macro *m = find_macro(tok, macros);
+      Macro *m = find_macro(tok);
       tok = tok->next;
 
       if (has_paren)
-        tok = skip(tok, ")");
+        tok = skip_punct(tok, ')');
       
       cur = cur->next  = new_num_token(m ? 1 : 0, start);
       continue;
@@ -879,11 +910,73 @@ static char *join_tokens(Token *tok, Token *end)
   return buf;
 }
 
+// The include directories are searched for each #include, so the
+// same paths are tried again and again. Whether each of them exists
+// is cached, misses as well as hits. A unit in a batch sends its
+// results back with the files it has read, so the later units start
+// with them.
+typedef struct FileLookup FileLookup;
+struct FileLookup
+{
+  char *path;
+  bool exists;
+  bool shared; // Already known to the batch driver
+};
+
+static HashMap file_lookups;
+
+static FileLookup *add_file_lookup(char *path, bool exists)
+{
+  FileLookup *fl = calloc(1, sizeof(FileLookup));
+  fl->path = strdup(path);
+  fl->exists = exists;
+  hashmap_put(&file_lookups, fl->path, fl);
+  return fl;
+}
+
 // Returns true if a given file exists.
 static bool file_exists(char *path)
 {
+  FileLookup *fl = hashmap_get(&file_lookups, path);
+  if (fl)
+    return fl->exists;
+
   struct stat st;
-  return !stat(path, &st);
+  return add_file_lookup(path, !stat(path, &st))->exists;
+}
+
+// Write the results of file_exists() to `fd` as "+ <path>" or
+// "- <path>" lines, in the format cache_file_list() reads.
+void write_file_lookups(int fd)
+{
+  FileLookup **fls = (FileLookup **)hashmap_values(&file_lookups);
+  for (int i = 0; fls[i]; i++)
+  {
+    if (fls[i]->shared)
+      continue;
+
+    char buf[PATHNAME_SIZE + 4];
+    int len = snprintf(buf, sizeof(buf), "%c %s\n",
+                       fls[i]->exists ? '+' : '-', fls[i]->path);
+    if (len < sizeof(buf))
+      write(fd, buf, len);
+  }
+  free(fls);
+}
+
+// Take a result of file_exists() a batch unit has reported.
+void cache_file_lookup(char *path, bool exists)
+{
+  add_file_lookup(path, exists)->shared = true;
+}
+
+// Returns the directory of the file `tok` is in.
+static char *file_dir(Token *tok)
+{
+  SourceFile *file = tok_file(tok);
+  if (!file->dir)
+    file->dir = dirname(strdup(file->path));
+  return file->dir;
 }
 
 // Join path
@@ -910,13 +1003,12 @@ char *join_paths(char *lhs, char *rhs)
 
 static char *search_include_paths(char *filename, Token *start, bool include_next)
 {
-  char *current_file_dir = dirname(strdup(start->filepath));
+  char *current_file_dir = file_dir(start);
   // Search a file from the include paths.
   for (char **p = include_paths; *p; p++)
   {
     char *path = join_paths(*p, filename);
-    char *abs_path = rel_to_abs("/", path);
-    if (include_next && !strncmp(current_file_dir, abs_path, strlen(current_file_dir)))
+    if (include_next && !strncmp(current_file_dir, rel_to_abs("/", path), strlen(current_file_dir)))
       continue;
 
     if (file_exists(path))
@@ -1045,8 +1137,60 @@ char *rel_to_abs(char *basePath, char *relativePath)
   return absolutePath;
 }
 
-// Read an #include argument.
-static char *read_include_path(Token **rest, Token *tok, bool include_next)
+// Resolved #include names. The key is the kind of #include and the
+// name as spelled, after the directory of the including file if the
+// result depends on it.
+static HashMap include_cache;
+
+static char *find_include_file(char *filename, bool quoted, Token *start, bool include_next)
+{
+  if (quoted)
+  {
+    // If `filename` is absolute path, just return it.
+    if (*filename == '/')
+      return filename;
+
+    // Search with relative path
+    char *filepath = rel_to_abs(file_dir(start), filename);
+    if (file_exists(filepath))
+      return filepath;
+  }
+  return search_include_paths(filename, start, include_next);
+}
+
+static char *find_include(char *filename, bool quoted, Token *start, bool include_next)
+{
+  char *dir = (quoted || include_next) ? file_dir(start) : "";
+  char key[PATHNAME_SIZE * 2];
+  int len = snprintf(key, sizeof(key), "%c%c%s%c%s", quoted ? '"' : '<',
+                     include_next ? 'n' : 'i', dir, '\0', filename);
+  if (len >= sizeof(key))
+    return find_include_file(filename, quoted, start, include_next);
+
+  char *path = hashmap_get2(&include_cache, key, len);
+  if (path)
+    return path;
+
+  path = find_include_file(filename, quoted, start, include_next);
+  char *key2 = malloc(len);
+  memcpy(key2, key, len);
+  hashmap_put2(&include_cache, key2, len, path);
+  return path;
+}
+
+// "." and ".." in an absolute path are resolved, so that
+// "/a/b/../c.h" and "/a/c.h" name the same file.
+static char *canonical_path(char *path)
+{
+  if (*path != '/')
+    return path;
+  return rel_to_abs("/", path);
+}
+
+// Read an #include argument. `directive` is the `include` token, so
+// that a name from a macro is still looked up from the file with the
+// directive.
+static char *read_include_path(Token **rest, Token *tok, Token *directive, bool include_next)
 {
   // Pattern 1: #include "foo.h"
   if (tok->kind == TK_STR)
@@ -1055,31 +1199,19 @@ static char *read_include_path(Token **rest, Token *tok, bool include_next)
     // and we don't want to interpret any escape sequances in it.
     // So we don't use token->contents.
 
-    Token *start = tok;
     char *filename = strndup(tok->loc + 1, tok->len - 2);
     *rest = skip_line(tok->next);
-
-    // If `filename` is absolute path, just return it.
-    if (*filename == '/')
-      return filename;
-
-    // Search with relative path
-    char *current_dir = dirname(strdup(tok->filepath));
-    char *filepath = rel_to_abs(current_dir, filename);
-    if (file_exists(filepath))
-      return filepath;
-    
-    return search_include_paths(filename, start, include_next);
+    return find_include(filename, true, directive, include_next);
   }
 
   // Pattern 2: #include <foo.h>
-  if (equal(tok, "<"))
+  if (equal_punct(tok, '<'))
   {
     // Reconstruct a filename from a sequence of tokens between "<" and ">".
     Token *start = tok;
 
     // Find closing ">".
-    for (; !equal(tok, ">"); tok = tok->next)
+    for (; !equal_punct(tok, '>'); tok = tok->next)
     {
       if (tok->kind == TK_EOF)
         error_tok(tok, "expected '>'");
@@ -1088,8 +1220,7 @@ static char *read_include_path(Token **rest, Token *tok, bool include_next)
     char *filename = join_tokens(start->next, tok);
     *rest = skip_line(tok->next);
 
-    char *path = search_include_paths(filename, start, include_next);
-    return path;
+    return find_include(filename, false, directive, include_next);
   }
 
   // Pattern 3 #include FOO
@@ -1098,7 +1229,7 @@ static char *read_include_path(Token **rest, Token *tok, bool include_next)
   if (tok->kind == TK_IDENT)
   {
     Token *tok2 = preprocess(copy_line(rest, tok));
-    return read_include_path(&tok2, tok2, include_next);
+    return read_include_path(&tok2, tok2, directive, include_next);
   }
 
   error_tok(tok, "expected a filename");
@@ -1112,13 +1243,19 @@ static Token *preprocess2(Token *tok)
 
   while (tok && tok->kind != TK_EOF)
   {
+    if (tok->kind == TK_LAZY)
+    {
+      resume_tokenize(tok);
+      continue;
+    }
+
     // Macro replacement
     if (expand_macro(&tok, tok))
     {
       continue;
     }
     // Preprocessing directive
-    if (!tok->at_bol || !equal(tok, "#"))
+    if (!tok->at_bol || !equal_punct(tok, '#'))
     {
       cur = cur->next = tok;
       tok = tok->next;
@@ -1133,7 +1270,7 @@ static Token *preprocess2(Token *tok)
     if (equal(tok, "define"))
     {
       tok = tok->next;
-      tok = push_macro(tok, &macros);
+      tok = push_macro(tok);
       continue;
     }
 
@@ -1141,7 +1278,7 @@ static Token *preprocess2(Token *tok)
     if (equal(tok, "undef"))
     {
       tok = tok->next;
-      tok = undef_macro(tok, &macros);
+      tok = read_undef(tok);
       continue;
     }
 
@@ -1149,13 +1286,36 @@ static Token *preprocess2(Token *tok)
     if (equal(tok, "include") || equal(tok, "include_next"))
     {
       bool include_next = equal(tok, "include_next");
-      char *file_path = read_include_path(&tok, tok->next, include_next);
+      char *file_path = read_include_path(&tok, tok->next, tok, include_next);
+
+      // Skip a file included before if it has `#pragma once`
+      // or its include guard is defined.
+      char *key = canonical_path(file_path);
+      if (hashmap_get(&pragma_once, key))
+        continue;
+      char *guard = hashmap_get(&include_guards, key);
+      if (guard && hashmap_get(&macros, guard))
+        continue;
+
       // Tokenize
       Token *included = tokenize_file(file_path);
       if (!included)
         error_tok(tok, "%s", strerror(errno));
+
+      // `#ifndef X` on the first line is an include guard if its
+      // `#endif` is the last line.
+      Token *ifndef = NULL;
+      if (equal_punct(included, '#') && equal(included->next, "ifndef") &&
+          included->next->next->kind == TK_IDENT)
+      {
+        ifndef = included->next;
+        guard = ifndef->next->ident;
+      }
+
       // Preprocess
       included = preprocess(included);
+      if (ifndef && ifndef == guard_end)
+        hashmap_put(&include_guards, key, guard);
 
       if (included->kind == TK_EOF)
         continue;
@@ -1183,7 +1343,7 @@ static Token *preprocess2(Token *tok)
     // #ifdef directive
     if (equal(tok, "ifdef"))
     {
-      bool defined = find_macro(tok->next, macros);
+      bool defined = find_macro(tok->next);
       push_cond_incl(tok, defined);
       tok = skip_line(tok->next->next);
       if (!defined)
@@ -1194,7 +1354,7 @@ static Token *preprocess2(Token *tok)
     // #ifndef directive
     if (equal(tok, "ifndef"))
     {
-      bool defined = find_macro(tok->next, macros);
+      bool defined = find_macro(tok->next);
       push_cond_incl(tok, !defined);
       tok = skip_line(tok->next->next);
       if (defined)
@@ -1234,8 +1394,34 @@ static Token *preprocess2(Token *tok)
     {
       if (!cond_incl)
         error_tok(hash, "stray #endif");
+      Token *start = cond_incl->ctx == IN_THEN ? cond_incl->tok : NULL;
       cond_incl = cond_incl->next;
       tok = skip_line(tok->next);
+
+      if (tok->kind == TK_LAZY)
+        resume_tokenize(tok);
+      if (tok->kind == TK_EOF)
+        guard_end = start;
+      continue;
+    }
+
+    // #pragma once
+    if (equal(tok, "pragma") && equal(tok->next, "once"))
+    {
+      hashmap_put(&pragma_once, canonical_path(tok_file(tok)->path), (void *)1);
+      tok = skip_line(tok->next->next);
+      continue;
+    }
+
+    // Other pragmas are ignored, but -E passes them through so that
+    // the compiler reading the output sees them.
+    if (equal(tok, "pragma"))
+    {
+      if (opt_E)
+        cur = cur->next = hash;
+      for (; !tok->at_bol; tok = tok->next)
+        if (opt_E)
+          cur = cur->next = tok;
       continue;
     }
 
@@ -1255,21 +1441,67 @@ static Token *preprocess2(Token *tok)
 static Macro *add_macro(char *name, bool is_objlike, Token *body)
 {
   Macro *m = calloc(1, sizeof(Macro));
-  m->next = macros;
-  m->name = name;
+  m->name = intern(name, strlen(name));
   m->is_objlike = is_objlike;
   m->body = body;
-  macros = m;
+  hashmap_put(&macros, m->name, m);
   return m;
 }
 
-static void define_macro(char *name, char *buf)
+void define_macro(char *name, char *buf)
 {
   Token *tok = tokenize("(internal)", 1, concat(buf, "\n"));
   tok->at_bol = false;
   add_macro(name, true, tok);
 }
 
+void undef_macro(char *name)
+{
+  hashmap_delete(&macros, intern(name, strlen(name)));
+}
+
+// -D option. "NAME" defines NAME as 1, and "NAME=VAL" as VAL. NAME
+// may have a parameter list, as in "F(x)=x+1". The definition is read
+// as if it were `#define NAME VAL`.
+void define_macro_arg(char *arg)
+{
+  char *buf = calloc(1, strlen(arg) + 4);
+  char *eq = strchr(arg, '=');
+  if (eq)
+    sprintf(buf, "%.*s %s\n", (int)(eq - arg), arg, eq + 1);
+  else
+    sprintf(buf, "%s 1\n", arg);
+  push_macro(tokenize("(internal)", 1, buf));
+}
+
+// -dM option. Print the macros defined at the end of the input.
+void print_macros()
+{
+  void **vals = hashmap_values(&macros);
+  for (int i = 0; vals[i]; i++)
+  {
+    Macro *m = vals[i];
+    if (m->handler)
+      continue;
+
+    printf("#define %s", m->name);
+    if (!m->is_objlike)
+    {
+      printf("(");
+      for (MacroParam *pp = m->params; pp; pp = pp->next)
+        printf(pp == m->params ? "%s" : ",%s", pp->name);
+      if (m->is_variadic)
+        printf(m->params ? ",..." : "...");
+      printf(")");
+    }
+    printf(" ");
+    for (Token *t = m->body; t->kind != TK_EOF; t = t->next)
+      printf(t != m->body && t->has_space ? " %.*s" : "%.*s", t->len, t->loc);
+    printf("\n");
+  }
+  free(vals);
+}
+
 static Macro *add_builtin(char *name, macro_handler_fn *fn)
 {
   Macro *m = add_macro(name, true, NULL);
@@ -1280,7 +1512,7 @@ static Macro *add_builtin(char *name, macro_handler_fn *fn)
 // __FILE__ macro
 static Token *file_macro(Token *tmpl)
 {
-  return new_str_token(tmpl->filename, tmpl);
+  return new_str_token(tok_file(tmpl)->name, tmpl);
 }
 
 // __LINE__ macro
@@ -1289,7 +1521,9 @@ static Token *line_macro(Token *tmpl)
   return new_num_token(tmpl->line_no, tmpl);
 }
 
-static void init_macros()
+// Define the predefined macros. This is done once at startup, and
+// the processes compiling each file inherit them.
+void init_macros()
 {
   // Define predefined macros
   // You can check predifined macros of gcc
@@ -1348,27 +1582,53 @@ static void join_adjacent_string_literals(Token *tok)
 {
   while (tok->kind != TK_EOF)
   {
-    Token *tok2 = tok->next;
-
-    if (tok->kind == TK_STR && tok2->kind == TK_STR)
+    if (tok->kind != TK_STR || tok->next->kind != TK_STR)
     {
-      char *buf = calloc(1, tok->len + tok2->len - 1);
-      sprintf(buf, "\"%.*s%.*s\"",
-              tok->len - 2, tok->loc + 1,
-              tok2->len - 2, tok2->loc + 1);
-      *tok = *tokenize(tok->filename, tok->file_no, buf);
-      tok->next = tok2->next;
+      tok = tok->next;
       continue;
     }
 
-    tok = tok->next;
+    // Measure the whole run of literals first, so that each of them
+    // is copied once. Their contents are already unescaped, so they
+    // are joined as they are.
+    Token *end = tok;
+    int len = 2;
+    int cont_len = 1;
+    for (; end->kind == TK_STR; end = end->next)
+    {
+      len += end->len - 2;
+      cont_len += end->lit->cont_len - 1;
+    }
+
+    char *buf = malloc(len + 1);
+    char *contents = malloc(cont_len);
+    char *p = buf;
+    char *q = contents;
+    *p++ = '"';
+    for (Token *t = tok; t != end; t = t->next)
+    {
+      memcpy(p, t->loc + 1, t->len - 2);
+      p += t->len - 2;
+      memcpy(q, t->lit->contents, t->lit->cont_len - 1);
+      q += t->lit->cont_len - 1;
+    }
+    *p++ = '"';
+    *p = '\0';
+    *q = '\0';
+
+    tok->loc = buf;
+    tok->len = len;
+    tok->lit = calloc(1, sizeof(Literal));
+    tok->lit->contents = contents;
+    tok->lit->cont_len = cont_len;
+    tok->next = end;
+    tok = end;
   }
 }
 
 Token *preprocess(Token *tok)
 {
-  init_macros();
-  add_dependency(tok->filepath);
+  add_dependency(tok_file(tok)->path);
   CondIncl *current_cond_incl = cond_incl;
   tok = preprocess2(tok);
   if (cond_incl != current_cond_incl)
@@ -18,5 +18,9 @@ kiwicc parse.c
 kiwicc codegen.c
 kiwicc tokenize.c
 kiwicc type.c
+kiwicc emit.c
+kiwicc hashmap.c
+kiwicc assemble.c
+kiwicc server.c
 
-(cd $TMP; riscv64-unknown-linux-gnu-gcc -o ../$OUTPUT *.o)
+(cd $TMP; riscv64-unknown-linux-gnu-gcc -pthread -o ../$OUTPUT *.o)
@@ -0,0 +1,502 @@
+#include "kiwicc.h"
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*********************************************
+* ...compile server...
+*********************************************/
+
+// `kiwicc --server` listens on a Unix domain socket, and
+// `kiwicc --client <args>` asks it to compile with the usual
+// arguments. The client passes its current directory, arguments and
+// standard input/output/error to the server, and waits for the exit
+// status.
+//
+// The server forks a child per request. The child reports the files
+// it has read, and if the request succeeds, the server reads and
+// tokenizes them so that the next requests start with them cached.
+//
+// The socket path is $KIWICC_SOCKET, or /tmp/kiwicc-<uid>.sock.
+//
+// `kiwicc @<file>` compiles the translation units listed in <file>
+// one after another in the same way, but without a server. Each line
+// of the file has the arguments for a unit. The units also pass on
+// which paths they have found to exist or not, so the include
+// directories are not searched again for the same names.
+
+#define MAX_REQUESTS 64
+
+typedef struct Request Request;
+struct Request
+{
+  pid_t pid;
+  int conn_fd;   // Connection to the client
+  int report_fd; // Read end of the pipe the child reports to
+  char *report;  // Reported file list
+  int report_len;
+};
+
+static Request requests[MAX_REQUESTS];
+static int num_requests;
+
+// Write end of the report pipe in a child
+static int report_fd = -1;
+
+static char *socket_path()
+{
+  char *path = getenv("KIWICC_SOCKET");
+  if (path && *path)
+    return path;
+
+  static char buf[64];
+  snprintf(buf, sizeof(buf), "/tmp/kiwicc-%d.sock", (int)getuid());
+  return buf;
+}
+
+static void set_socket_addr(struct sockaddr_un *addr, char *path)
+{
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path))
+    error("socket path too long: %s", path);
+  strcpy(addr->sun_path, path);
+}
+
+static bool read_full(int fd, void *buf, int len)
+{
+  char *p = buf;
+  while (len > 0)
+  {
+    int n = read(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool write_full(int fd, void *buf, int len)
+{
+  char *p = buf;
+  while (len > 0)
+  {
+    int n = write(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+/*** Client ***/
+
+// Send a request to the server and return its exit status,
+// or -1 if the server is not running.
+int run_client(int argc, char **argv)
+{
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1)
+    return -1;
+
+  struct sockaddr_un addr;
+  set_socket_addr(&addr, socket_path());
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+  {
+    close(fd);
+    return -1;
+  }
+
+  // The payload is the current directory and the arguments,
+  // each terminated by '\0'. The current directory takes the place
+  // of argv[0].
+  char cwd[PATHNAME_SIZE];
+  if (!getcwd(cwd, sizeof(cwd)))
+    error("getcwd failed: %s", strerror(errno));
+  int len = strlen(cwd) + 1;
+  for (int i = 1; i < argc; i++)
+    len += strlen(argv[i]) + 1;
+
+  char *payload = malloc(len);
+  char *p = payload;
+  strcpy(p, cwd);
+  p += strlen(cwd) + 1;
+  for (int i = 1; i < argc; i++)
+  {
+    strcpy(p, argv[i]);
+    p += strlen(argv[i]) + 1;
+  }
+
+  // Send the payload length along with our stdin, stdout and stderr.
+  int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  long cmsg_buf[8] = {};
+  struct iovec iov = {&len, sizeof(len)};
+  struct msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cmsg_buf;
+  msg.msg_controllen = CMSG_SPACE(sizeof(fds));
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  if (sendmsg(fd, &msg, 0) == -1 || !write_full(fd, payload, len))
+    error("cannot send a request to the compile server: %s", strerror(errno));
+
+  int status;
+  if (!read_full(fd, &status, sizeof(status)))
+    error("lost connection to the compile server");
+  close(fd);
+  return status;
+}
+
+/*** Server ***/
+
+static void report_input_files()
+{
+  write_input_files(report_fd);
+}
+
+// Make a pipe for a child to report the files it has read.
+static bool open_report_pipe(int *fds)
+{
+  if (pipe(fds) == -1)
+    return false;
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+  return true;
+}
+
+// Run a request in a child process. This never returns.
+static void run_request(int *fds, char *payload, int len)
+{
+  for (int i = 0; i < 3; i++)
+  {
+    dup2(fds[i], i);
+    close(fds[i]);
+  }
+
+  char *cwd = payload;
+  if (chdir(cwd) == -1)
+    error("cannot change directory to %s: %s", cwd, strerror(errno));
+
+  // Split the arguments. argv[0] is the directory, which is
+  // ignored like the program name.
+  int argc = 0;
+  char **argv = calloc(len + 1, sizeof(char *));
+  for (char *p = payload; p < payload + len; p += strlen(p) + 1)
+    argv[argc++] = p;
+
+  atexit(report_input_files);
+  exit(run_compiler(argc, argv));
+}
+
+static void accept_request(int listen_fd)
+{
+  int conn_fd = accept(listen_fd, NULL, NULL);
+  if (conn_fd == -1)
+    return;
+
+  int len;
+  long cmsg_buf[8] = {};
+  struct iovec iov = {&len, sizeof(len)};
+  struct msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cmsg_buf;
+  msg.msg_controllen = sizeof(cmsg_buf);
+
+  int fds[3] = {-1, -1, -1};
+  int n = recvmsg(conn_fd, &msg, 0);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(sizeof(fds)))
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+  char *payload = NULL;
+  bool ok = n == sizeof(len) && fds[0] != -1 && len > 0 && len < (1 << 20);
+  if (ok)
+  {
+    payload = malloc(len + 1);
+    payload[len] = '\0';
+    ok = read_full(conn_fd, payload, len);
+  }
+
+  int pipe_fds[2];
+  if (ok && !open_report_pipe(pipe_fds))
+    ok = false;
+
+  if (!ok)
+  {
+    for (int i = 0; i < 3; i++)
+      if (fds[i] != -1)
+        close(fds[i]);
+    close(conn_fd);
+    free(payload);
+    return;
+  }
+
+  pid_t pid = fork();
+  if (pid == 0)
+  {
+    // Don't keep the other clients waiting for this child.
+    close(listen_fd);
+    for (int i = 0; i < num_requests; i++)
+    {
+      close(requests[i].conn_fd);
+      close(requests[i].report_fd);
+    }
+    close(conn_fd);
+    close(pipe_fds[0]);
+    report_fd = pipe_fds[1];
+    run_request(fds, payload, len);
+  }
+
+  for (int i = 0; i < 3; i++)
+    close(fds[i]);
+  close(pipe_fds[1]);
+  free(payload);
+
+  if (pid == -1)
+  {
+    close(pipe_fds[0]);
+    close(conn_fd);
+    return;
+  }
+
+  Request *req = &requests[num_requests++];
+  memset(req, 0, sizeof(*req));
+  req->pid = pid;
+  req->conn_fd = conn_fd;
+  req->report_fd = pipe_fds[0];
+}
+
+// Read the report from a child. If the child has finished,
+// send its exit status to the client and returns true.
+static bool read_report(Request *req)
+{
+  char buf[4096];
+  int n = read(req->report_fd, buf, sizeof(buf));
+  if (n < 0 && errno == EINTR)
+    return false;
+  if (n > 0)
+  {
+    req->report = realloc(req->report, req->report_len + n + 1);
+    memcpy(req->report + req->report_len, buf, n);
+    req->report_len += n;
+    req->report[req->report_len] = '\0';
+    return false;
+  }
+
+  int status = 0;
+  while (waitpid(req->pid, &status, 0) == -1)
+    if (errno != EINTR)
+      break;
+  int exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+  write_full(req->conn_fd, &exit_status, sizeof(exit_status));
+  close(req->conn_fd);
+  close(req->report_fd);
+
+  // Successfully compiled files are safe to tokenize here.
+  if (exit_status == 0 && req->report)
+    cache_file_list(req->report);
+  free(req->report);
+  return true;
+}
+
+int run_server()
+{
+  char *path = socket_path();
+  struct sockaddr_un addr;
+  set_socket_addr(&addr, path);
+
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd == -1)
+    error("socket failed: %s", strerror(errno));
+
+  unlink(path);
+  if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    error("cannot bind %s: %s", path, strerror(errno));
+  if (listen(listen_fd, SOMAXCONN) == -1)
+    error("listen failed: %s", strerror(errno));
+
+  // Clients may go away before we reply.
+  signal(SIGPIPE, SIG_IGN);
+
+  for (;;)
+  {
+    // While all the slots are in use, new connections wait in the
+    // listen queue instead of being accepted and dropped.
+    struct pollfd pfds[MAX_REQUESTS + 1];
+    pfds[0].fd = num_requests < MAX_REQUESTS ? listen_fd : -1;
+    pfds[0].events = POLLIN;
+    for (int i = 0; i < num_requests; i++)
+    {
+      pfds[i + 1].fd = requests[i].report_fd;
+      pfds[i + 1].events = POLLIN;
+    }
+
+    if (poll(pfds, num_requests + 1, -1) == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      error("poll failed: %s", strerror(errno));
+    }
+
+    // Handle the finished requests first so that their slots are freed.
+    int nreqs = num_requests;
+    for (int i = nreqs - 1; i >= 0; i--)
+    {
+      if (!pfds[i + 1].revents)
+        continue;
+      if (read_report(&requests[i]))
+        requests[i] = requests[--num_requests];
+    }
+
+    if (pfds[0].revents & POLLIN)
+      accept_request(listen_fd);
+  }
+}
+
+/*** Batch mode ***/
+
+// Split a line into arguments at whitespace. Double quotes can be
+// used for an argument containing whitespace.
+static char **split_args(char *line, int *argc)
+{
+  char **argv = calloc(strlen(line) + 2, sizeof(char *));
+  int n = 1; // argv[0] is the program name, which is ignored.
+  char *p = line;
+
+  for (;;)
+  {
+    while (isspace(*p))
+      p++;
+    if (!*p)
+      break;
+
+    char *q = p;
+    argv[n++] = q;
+    while (*p && !isspace(*p))
+    {
+      if (*p != '"')
+      {
+        *q++ = *p++;
+        continue;
+      }
+      for (p++; *p && *p != '"'; p++)
+        *q++ = *p;
+      if (*p)
+        p++;
+    }
+    if (*p)
+      p++;
+    *q = '\0';
+  }
+
+  *argc = n;
+  return argv;
+}
+
+// A unit also reports which files it has found to exist or not.
+// The server doesn't take those, since files may come and go
+// between its requests.
+static void report_unit_files()
+{
+  write_file_lookups(report_fd);
+  write_input_files(report_fd);
+}
+
+// Compile a unit in a child process and return its exit status.
+static int run_unit(char *line)
+{
+  int argc;
+  char **argv = split_args(line, &argc);
+  if (argc == 1)
+    return 0;
+
+  int fds[2];
+  if (!open_report_pipe(fds))
+    error("pipe failed: %s", strerror(errno));
+
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid == -1)
+    error("fork failed: %s", strerror(errno));
+
+  if (pid == 0)
+  {
+    close(fds[0]);
+    report_fd = fds[1];
+    atexit(report_unit_files);
+    exit(run_compiler(argc, argv));
+  }
+
+  close(fds[1]);
+  char *report = NULL;
+  int len = 0;
+  char buf[4096];
+  for (;;)
+  {
+    int n = read(fds[0], buf, sizeof(buf));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    report = realloc(report, len + n + 1);
+    memcpy(report + len, buf, n);
+    len += n;
+    report[len] = '\0';
+  }
+  close(fds[0]);
+
+  int status = 0;
+  while (waitpid(pid, &status, 0) == -1)
+    if (errno != EINTR)
+      error("waitpid failed: %s", strerror(errno));
+  int exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+
+  if (exit_status == 0 && report)
+    cache_file_list(report);
+  free(report);
+  free(argv);
+  return exit_status;
+}
+
+// Compile all the units listed in `path`. Returns non-zero
+// if any of them fails.
+int run_batch(char *path)
+{
+  // Read the whole list first. The children must not share
+  // the file position with us.
+  FILE *fp = fopen(path, "r");
+  if (!fp)
+    error("cannot open %s: %s", path, strerror(errno));
+
+  char **lines = NULL;
+  int nlines = 0;
+  char *line = NULL;
+  size_t cap = 0;
+  while (getline(&line, &cap, fp) != -1)
+  {
+    lines = realloc(lines, sizeof(char *) * (nlines + 1));
+    lines[nlines++] = strdup(line);
+  }
+  free(line);
+  fclose(fp);
+
+  int status = 0;
+  for (int i = 0; i < nlines; i++)
+    if (run_unit(lines[i]))
+      status = 1;
+  return status;
+}
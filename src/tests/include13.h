@@ -0,0 +1,7 @@
+#pragma once
+#ifdef INCLUDE13_COUNT
+#undef INCLUDE13_COUNT
+#define INCLUDE13_COUNT 2
+#else
+#define INCLUDE13_COUNT 1
+#endif
@@ -0,0 +1,7 @@
+#ifndef INCLUDE14_H
+#define INCLUDE14_H
+#define INCLUDE14_COUNT 1
+#else
+#undef INCLUDE14_COUNT
+#define INCLUDE14_COUNT 2
+#endif
@@ -0,0 +1,4 @@
+#ifndef INCLUDE15_H
+#define INCLUDE15_H
+int include15_var = 15;
+#endif
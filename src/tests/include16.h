@@ -0,0 +1,3 @@
+INCLUDE16_X(1)
+INCLUDE16_X(2)
+INCLUDE16_X(3)
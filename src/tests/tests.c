@@ -110,6 +110,9 @@ int _Alignas(512) g_aligned1;
 int _Alignas(512) g_aligned2;
 int _Alignas(128) g_aligned3;
 
+_Thread_local int g_tls1 = 7;
+__thread int g_tls2;
+
 int assert(long expected, long actual, char *code)
 {
   if (expected == actual)
@@ -161,6 +164,7 @@ int fib(int x)
   return fib(x - 1) + fib(x - 2);
 }
 int sum_arr_elems(int *a) { return a[0] + a[1] + a[2]; }
+int sum_arr_elems_q(int a[static 3], int b[const restrict]) { return a[0] + a[1] + a[2] + b[0]; }
 int need_large_stack() {int a[1000]; return a[999]=1; }
 
 int add_char1(char a, char b, char c) { return a + b + c; }
@@ -215,6 +219,11 @@ int counter()
   static int a = 5;
   return i++ + a;
 }
+int tls_counter()
+{
+  static _Thread_local int i = 2;
+  return i++;
+}
 int ret_none()
 {
   3;
@@ -287,6 +296,19 @@ char *fmt(char *buf, char *fmt, ...)
   vsprintf(buf, fmt, ap);
 }
 
+#include <stdarg.h>
+
+long sum_varargs(int n, ...)
+{
+  va_list ap;
+  va_start(ap, n);
+  long sum = 0;
+  for (int i = 0; i < n; i++)
+    sum = sum + va_arg(ap, long);
+  va_end(ap);
+  return sum;
+}
+
 int main()
 {
   assert(0, 0, "0");
@@ -420,6 +442,7 @@ int main()
   assert(4, ({ int x[2][3]; x[0][4]=4; *(*(x+1)+1); }), "({ int x[2][3]; x[0][4]=4; *(*(x+1)+1); })");
   assert(5, ({ int x[2][3]; x[0][5]=5; *(*(x+1)+2); }), "({ int x[2][3]; x[0][5]=5; *(*(x+1)+2); })");
   assert(5, ({int x[3]; x[0]=1;x[1]=2;x[2]=2; sum_arr_elems(x); }), "{int x[3]; x[0]=1;x[1]=2;x[2]=2; sum_arr_elems(x);}");
+  assert(8, ({int x[3]; x[0]=1;x[1]=2;x[2]=2; sum_arr_elems_q(x, x + 2); }), "{int x[3]; x[0]=1;x[1]=2;x[2]=2; sum_arr_elems_q(x, x + 2);}");
 
   assert(0, ({ g1=0; g1; }), "({ g1=0; g1; })");
   assert(1, ({ g1 = 1; g1; }), "({ g1 = 1; g1; })");
@@ -518,6 +541,9 @@ int main()
   assert(16, ({ struct {int a; struct {char b; char c[5];} y[2];} x; sizeof(x); }), "({ struct {int a; struct {char b; char c[5];} y[2];} x; sizeof(x); })");
   assert(12, ({ struct {int a, b; char c, d, e, f;} x; sizeof(x); }), "({ struct {int a, b; char c, d, e, f;} x; sizeof(x); })");
   assert(8, ({ struct {char a; int b;} x; sizeof(x); }), "({ struct {char a; int b;} x; sizeof(x); })");
+  assert(4, ({ struct {int a; char b[];} x; sizeof(x); }), "({ struct {int a; char b[];} x; sizeof(x); })");
+  assert(8, ({ struct {char a; long b[];} x; sizeof(x); }), "({ struct {char a; long b[];} x; sizeof(x); })");
+  assert(4, ({ struct {int a; char b[];} x; x.b - (char *)&x; }), "({ struct {int a; char b[];} x; x.b - (char *)&x; })");
 
   assert(8, ({ int x; int y; int z; char *a=&x; char *b=&y; char *c=&z; c-a; }), "({ int x; int y; int z; char *a=&x; char *b=&y; char *c=&z; c-a; })");
   assert(8, ({ int x; char y; int z; char *a=&x; char *b=&y; char *c=&z; c-a; }), "({ int x; char y; int z; char *a=&x; char *b=&y; char *c=&z; c-a; })");
@@ -989,6 +1015,9 @@ int main()
   assert(15, add_all3(1, 2, 3, 4, 5, 0), "add_all3(1, 2, 3, 4, 5, 0)");
   assert(0, ({ char buf[100]; sprintf(buf, "%d %d %s", 1, 2, "foo"); strcmp("1 2 foo", buf); }), "({ char buf[100]; sprintf(buf, \"%d %d %s\", 1, 2, \"foo\"); strcmp(\"1 2 foo\", buf); })");
   assert(0, ({ char buf[100]; fmt(buf, "%d %d %s", 1, 2, "foo"); strcmp("1 2 foo", buf); }), "({ char buf[100]; fmt(buf, \"%d %d %s\", 1, 2, \"foo\"); strcmp(\"1 2 foo\", buf); })");
+  assert(0, sum_varargs(0), "sum_varargs(0)");
+  assert(6, sum_varargs(3, 1, 2, 3), "sum_varargs(3, 1, 2, 3)");
+  assert(10000000000, sum_varargs(2, 9999999999, 1), "sum_varargs(2, 9999999999, 1)");
 
   assert(15, ({ int i=1, sum=0; do {sum+=i;} while (i++<5); sum; }), "({ int i=1, sum=0; do {sum+=i;} while (i++<5); sum; })");
   assert(10, ({ int i=1, sum=0; do {sum+=i; if (sum==10) break; continue; sum*=100; } while (i++<5); sum; }), "({ int i=1, sum=0; do {sum+=i; if (sum==10) break; continue; sum*=100; } while (i++<5); sum; })");
@@ -1378,6 +1407,9 @@ int main()
 
   assert(0, ({ char buf[100]; sprintf(buf, "%.1f", 3.5f); strcmp(buf, "3.5"); }), "({ char buf[100]; sprintf(buf, \"%.1f\", 3.5f); strcmp(buf, \"3.5\"); })");
   assert(0, ({ char buf[100]; sprintf(buf, "%.1lf", 3.5); strcmp(buf, "3.5"); }), "({ char buf[100]; sprintf(buf, \"%.1lf\", 3.5); strcmp(buf, \"3.5\"); })");
+  assert(1, 09.5 == 9.5, "09.5 == 9.5");
+  assert(1, 0.1 + 0.2 != 0.3, "0.1 + 0.2 != 0.3");
+  assert(1, 123456789012345678e-17 == 1.23456789012345678, "123456789012345678e-17 == 1.23456789012345678");
   assert(0, ({ char buf[100]; fmt(buf, "%.1f", 3.5f); strcmp(buf, "3.5"); }), "({ char buf[100]; fmt(buf, \"%.1f\", 3.5f); strcmp(buf, \"3.5\"); })");
   assert(1, g34 - 1.5141 < 0.001, "g34 - 1.5141 < 0.001");
   assert(1, g35 - 3.85 < 0.001, "g35 - 3.85 < 0.001");
@@ -1396,6 +1428,20 @@ int main()
 # if 1
   assert(0, 1, "1");
 # endif
+#endif
+#if 0
+  Skipped lines don't have to be tokens: 'unterminated "literals $
+/*
+#endif
+*/ # else
+  assert(1437, __LINE__, "__LINE__");
+#endif
+#if 0
+#/**/if 1
+  assert(0, 1, "1");
+#/**/endif
+  # /* c */ else
+  assert(1, 1, "# /* c */ else");
 #endif
   {
     int m = 0;
@@ -1535,6 +1581,148 @@ int main()
 #define M9(x,y) x y
   assert(9, M9(,3+6), "M9(,3+6)");
   assert(9, M9(3+6, ), "M9(3+6, )");
+  // More blank lines than the lexer tokenizes at a time
+  assert(9, M9
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+  (3+6, ), "M9 <140 blank lines> (3+6, )");
 
 #define M10(x) M11(x) * x
 #define M11(x) M10(x) + 3
@@ -1549,11 +1737,13 @@ int main()
   assert('1', M12(a!b 1""c)[4], "M12(a!b 1\"\"c)[4]");
   assert('"', M12(a!b 1""c)[5], "M12(a!b 1\"\"c)[5]");
   assert('"', M12(a!b 1""c)[6], "M12(a!b 1\"\"c)[6]");
+  assert(10, sizeof(M12(a!b 1""c)), "sizeof(M12(a!b 1\"\"c))");
   assert('c', M12(a!b 1""c)[7], "M12(a!b 1\"\"c)[7]");
   assert(0, M12(a!b 1""c)[8], "M12(a!b 1\"\"c)[8]");
 
 #define paste(x,y) x##y
   assert(15, paste(1,5), "paste(1,5)");
+  assert(4, sizeof(paste(1,5)), "sizeof(paste(1,5))");
   assert(255, paste(0, xff), "paste(0x, ff)");
   assert(3, ({ int ab = 3; paste(a,b); }), "({ int ab = 3; paste(a,b); })");
   assert(5, paste(5, ), "paste(5, )");
@@ -1647,6 +1837,9 @@ of(char), \
   assert(9, sizeof("abc" "def" "gh"), "sizeof(\"abc\" \"def\" \"gh\")");
   assert(0, strcmp("abc" "def", "abcdef"), "strcmp(\"abc\" \"def\", \"abcdef\")");
   assert(0, strcmp("abc" "def" "gh", "abcdefgh"), "strcmp(\"abc\" \"def\" \"gh\", \"abcdefgh\")");
+  assert(3, sizeof("\x1" "2"), "sizeof(\"\\x1\" \"2\")");
+  assert(50, ("\x1" "2")[1], "(\"\\x1\" \"2\")[1]");
+  assert(1, "abc" == "abc", "\"abc\" == \"abc\"");
 
 #if 1
 #include "include4.h"
@@ -1688,6 +1881,28 @@ of(char), \
   assert(121, INCLUDE12_M1, "INCLUDE12_M1");
   assert(122, INCLUDE12_M2, "INCLUDE12_M2");
 
+#include "include13.h"
+#include <test_include/../include13.h>
+  assert(1, INCLUDE13_COUNT, "INCLUDE13_COUNT");
+#include "include14.h"
+#include "include14.h"
+  assert(2, INCLUDE14_COUNT, "INCLUDE14_COUNT");
+#include "include15.h"
+#include "include15.h"
+  assert(15, include15_var, "include15_var");
+
+  {
+    int x = 0;
+#define INCLUDE16_X(n) x += n;
+#include "include16.h"
+#undef INCLUDE16_X
+#define INCLUDE16_X(n) x *= n;
+#include "include16.h"
+#include "include16.h"
+    assert(216, x, "x");
+  }
+#pragma pack(1)
+
   {
 #define M16(x,y) x+y
   int x = M16(1,
@@ -1724,6 +1939,13 @@ of(char), \
 
   assert(2, comma_sep_fn1(2), "comma_sep_fn1(2)");
   assert(4, comma_sep_fn2(2), "comma_sep_fn2(2)");
+
+  assert(7, g_tls1, "g_tls1");
+  assert(0, g_tls2, "g_tls2");
+  assert(9, ({ g_tls2 = 9; g_tls2; }), "({ g_tls2 = 9; g_tls2; })");
+  assert(9, ({ int *p = &g_tls2; *p; }), "({ int *p = &g_tls2; *p; })");
+  assert(2, tls_counter(), "tls_counter()");
+  assert(3, tls_counter(), "tls_counter()");
   
   printf("OK\n");
   return 0;
@@ -1,12 +1,18 @@
 #include "kiwicc.h"
+#include <sys/mman.h>
 
 /*********************************************
 * ...tokenizer...
 *********************************************/
 
-// Input filename
-static char *current_filename;
-static char *current_filepath;
+// All the inputs tokenized so far. A token refers to its input
+// by the index in this table.
+static SourceFile **source_files;
+static int num_source_files;
+
+// The input being tokenized
+static SourceFile *current_file;
+static int current_file_id;
 
 // True if the current position is at the biggining of a line.
 static bool at_bol;
@@ -14,15 +20,19 @@ static bool at_bol;
 // Input string
 char *current_input;
 
+// The first token in the current line
+static Token *line_head;
+
 // A list of all input files.
 static char **input_files;
+static struct stat *input_file_stats;
 
 // True if the current position follows a space character.
 static bool has_space;
 
 // Report error
 // Take the same arguments as printf()
-void error(char *fmt, ...)
+_Noreturn void error(char *fmt, ...)
 {
   va_list ap;
   va_start(ap, fmt);
@@ -70,27 +80,42 @@ static void verror_at(char *filename, char *input, int line_no, char *loc, char
   fprintf(stderr, "\n");
 }
 
+// Returns the number of the line `loc` is in.
+static int find_line_no(char *loc)
+{
+  // Find the last line that starts at or before `loc`.
+  int offset = loc - current_input;
+  int lo = 0;
+  int hi = current_file->num_lines - 1;
+  while (lo < hi)
+  {
+    int mid = (lo + hi + 1) / 2;
+    if (current_file->line_starts[mid] <= offset)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return lo + 1;
+}
+
 // Report an error position and exit
-void error_at(char *loc, char *fmt, ...)
+_Noreturn void error_at(char *loc, char *fmt, ...)
 {
-  // Get a line number
-  int line_no = 1;
-  for (char *p = current_input; p < loc; p++)
-    if (*p == '\n')
-      line_no++;
+  int line_no = find_line_no(loc);
 
   va_list ap;
   va_start(ap, fmt);
-  verror_at(current_filename, current_input, line_no, loc, fmt, ap);
+  verror_at(current_file->name, current_input, line_no, loc, fmt, ap);
   exit(1);
 }
 
 // Report an error position and exit
-void error_tok(Token *tok, char *fmt, ...)
+_Noreturn void error_tok(Token *tok, char *fmt, ...)
 {
   va_list ap;
   va_start(ap, fmt);
-  verror_at(tok->filename, tok->input, tok->line_no, tok->loc, fmt, ap);
+  SourceFile *file = tok_file(tok);
+  verror_at(file->name, file->contents, tok->line_no, tok->loc, fmt, ap);
   exit(1);
 }
 
@@ -98,12 +123,21 @@ void warn_tok(Token *tok, char *fmt, ...)
 {
   va_list ap;
   va_start(ap, fmt);
-  verror_at(tok->filename, tok->input, tok->line_no, tok->loc, fmt, ap);
+  SourceFile *file = tok_file(tok);
+  verror_at(file->name, file->contents, tok->line_no, tok->loc, fmt, ap);
 }
 
+static int read_punct(char *p, int *len);
+
 // Consumes the current token if it matches `s`.
 bool equal(Token *tok, char *s)
 {
+  // Punctuators are compared by their IDs.
+  if (tok->kind == TK_RESERVED)
+  {
+    int len;
+    return tok->punct == read_punct(s, &len) && !s[len];
+  }
   return strlen(s) == tok->len &&
          !strncmp(tok->loc, s, tok->len);
 }
@@ -116,33 +150,127 @@ Token *skip(Token *tok, char *s)
   return tok->next;
 }
 
+// Returns true if the current token is the punctuator `punct`, which
+// is a character or a Punct. Unlike equal(), this needs no string
+// compare, so the parser uses it for punctuators.
+bool equal_punct(Token *tok, int punct)
+{
+  return tok->kind == TK_RESERVED && tok->punct == punct;
+}
+
+// Ensure that the current token is the one-character punctuator `c`.
+Token *skip_punct(Token *tok, char c)
+{
+  if (!equal_punct(tok, c))
+    error_tok(tok, "expected '%c'", c);
+  return tok->next;
+}
+
+/*** Token storage ***/
+
+// Tokens are allocated from large chunks, so the tokens made one
+// after another, which are usually linked in that order, are next
+// to each other in memory.
+#define TOKENS_PER_CHUNK 4096
+
+static Token *alloc_token()
+{
+  static Token *chunk;
+  static int used = TOKENS_PER_CHUNK;
+
+  if (used == TOKENS_PER_CHUNK)
+  {
+    chunk = calloc(TOKENS_PER_CHUNK, sizeof(Token));
+    used = 0;
+  }
+  return &chunk[used++];
+}
+
 Token *copy_token(Token *tok)
 {
-  Token *ret = malloc(sizeof(Token));
+  Token *ret = alloc_token();
   *ret = *tok;
   return ret;
 }
 
+SourceFile *tok_file(Token *tok)
+{
+  return source_files[tok->file];
+}
+
+static void new_source_file(char *filename, int file_no, char *p, bool padded)
+{
+  SourceFile *file = calloc(1, sizeof(SourceFile));
+  file->name = basename(strdup(filename));
+  file->path = filename;
+  file->contents = p;
+  file->file_no = file_no;
+  file->padded = padded;
+
+  source_files = realloc(source_files, sizeof(SourceFile *) * (num_source_files + 1));
+  source_files[num_source_files] = file;
+  current_file = file;
+  current_file_id = num_source_files++;
+}
+
+static Literal *new_literal(Token *tok)
+{
+  tok->lit = calloc(1, sizeof(Literal));
+  return tok->lit;
+}
+
 static bool startswith(char *tgt, char *ref)
 {
   return strncmp(tgt, ref, strlen(ref)) == 0;
 }
 
+/*** Character classes ***/
+
+#define C_SPACE 1 // Whitespace characters
+#define C_DIGIT 2 // Decimal digits
+#define C_ALPHA 4 // Letters and underscore
+#define C_HEX 8   // Hexadecimal digits
+
+static unsigned char char_class[256];
+
+static void init_char_class()
+{
+  for (int c = 0; c < 256; c++)
+  {
+    if (isspace(c))
+      char_class[c] |= C_SPACE;
+    if (isdigit(c))
+      char_class[c] |= C_DIGIT | C_HEX;
+    if (('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || c == '_')
+      char_class[c] |= C_ALPHA;
+    if (('a' <= c && c <= 'f') || ('A' <= c && c <= 'F'))
+      char_class[c] |= C_HEX;
+  }
+}
+
+static bool is_space(char c)
+{
+  return char_class[(unsigned char)c] & C_SPACE;
+}
+
+static bool is_digit(char c)
+{
+  return char_class[(unsigned char)c] & C_DIGIT;
+}
+
 static bool is_alpha(char c)
 {
-  return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || c == '_';
+  return char_class[(unsigned char)c] & C_ALPHA;
 }
 
 static bool is_alnum(char c)
 {
-  return is_alpha(c) || isdigit(c);
+  return char_class[(unsigned char)c] & (C_ALPHA | C_DIGIT);
 }
 
 static bool is_hex(char c)
 {
-  return ('0' <= c && c <= '9') ||
-         ('a' <= c && c <= 'f') ||
-         ('A' <= c && c <= 'F');
+  return char_class[(unsigned char)c] & C_HEX;
 }
 
 static int from_hex(char c)
@@ -167,77 +295,307 @@ static int var_len(char *p)
   return cnt_len;
 }
 
-static bool is_keyword(Token *tok)
+/*** Word-at-a-time scanning ***/
+
+// These functions look at a word (8 bytes on 64-bit hosts) at a time.
+// Words are loaded only from aligned addresses, and only from files
+// read by read_file(), whose buffers are zero-filled up to a word
+// boundary after the terminating '\0', so a load never reads outside
+// the buffer. The other inputs, such as the strings the preprocessor
+// makes, are scanned a byte at a time.
+
+typedef unsigned long Word;
+
+#define ONES ((Word)-1 / 0xff) // 0x0101...01
+#define HIGHS (ONES * 0x80)    // 0x8080...80
+
+// Evaluates to a word with 0x80 in each byte where `w` is zero,
+// and 0 in the others. This is a macro so that it is expanded
+// in the loops even without optimization.
+#define ZERO_BYTES(w) (~((((w) & ~HIGHS) + ~HIGHS) | (w)) & HIGHS)
+
+// Returns the first byte at or after `p` that is `a`, `b` or '\0'.
+static char *find_byte2(char *p, char a, char b)
 {
-  char *p = strndup(tok->loc, tok->len);
-  // Keywords
-  static char *kw[] = {
-      "return", "if", "else",
-      "while", "do", "for", "sizeof",
-      "int", "char", "struct", "union", "enum",
-      "short", "long", "void", "_Bool", "typedef",
-      "static", "extern", "break", "continue", "goto",
-      "switch", "case", "default", "_Alignof", "_Alignas",
-      "signed", "unsigned", "const",
-      "volatile", "register", "restrict", "_Noreturn",
-      "inline", "float", "double"
-      };
+  for (; !current_file->padded || (unsigned long)p % sizeof(Word); p++)
+    if (*p == a || *p == b || !*p)
+      return p;
 
-  for (int i = 0; i < sizeof(kw) / sizeof(*kw); ++i)
+  Word wa = ONES * (unsigned char)a;
+  Word wb = ONES * (unsigned char)b;
+  for (;; p += sizeof(Word))
   {
-    int len = strlen(kw[i]);
-    if (startswith(p, kw[i]) && !is_alnum(p[len]))
-      return true;
+    Word w;
+    memcpy(&w, p, sizeof(w));
+    Word xa = w ^ wa;
+    Word xb = w ^ wb;
+    if (ZERO_BYTES(xa) | ZERO_BYTES(xb) | ZERO_BYTES(w))
+      break;
   }
 
-  return false;
+  while (*p != a && *p != b && *p)
+    p++;
+  return p;
 }
 
-void convert_keywords(Token *tok)
+// Returns the first newline or '\0' at or after `p`.
+static char *find_newline(char *p)
 {
-  for (Token *t = tok; t->kind != TK_EOF; t = t->next)
+  return find_byte2(p, '\n', '\n');
+}
+
+// Returns the first '"', '\\' or '\0' at or after `p`.
+static char *find_quote_or_backslash(char *p)
+{
+  return find_byte2(p, '"', '\\');
+}
+
+// Returns the first byte at or after `p` that is not a space or a tab.
+static char *skip_blanks(char *p)
+{
+  for (; !current_file->padded || (unsigned long)p % sizeof(Word); p++)
+    if (*p != ' ' && *p != '\t')
+      return p;
+
+  Word spaces = ONES * ' ';
+  Word tabs = ONES * '\t';
+  for (;; p += sizeof(Word))
   {
-    if (t->kind == TK_IDENT && is_keyword(t))
-      t->kind = TK_RESERVED;
+    Word w;
+    memcpy(&w, p, sizeof(w));
+    Word xs = w ^ spaces;
+    Word xt = w ^ tabs;
+    if ((ZERO_BYTES(xs) | ZERO_BYTES(xt)) != HIGHS)
+      break;
   }
+
+  while (*p == ' ' || *p == '\t')
+    p++;
+  return p;
 }
 
-// Check if p starts with a reserved keyword
-static char *starts_with_multi_letter_symbol(char *p)
+/*** Identifiers ***/
+
+// Each identifier is stored once, so two names are the same
+// if and only if the pointers are.
+static HashMap atoms;
+
+// Returns the unique copy of the `len` bytes at `s`.
+char *intern(char *s, int len)
+{
+  char *atom = hashmap_get2(&atoms, s, len);
+  if (atom)
+    return atom;
+  atom = strndup(s, len);
+  hashmap_put2(&atoms, atom, len, atom);
+  return atom;
+}
+
+/*** Keywords ***/
+
+static struct
 {
-  // Three-letter punctuators
-  static char *ops3[] = {"<<=", ">>=", "..."};
-  for (int i = 0; i < sizeof(ops3) / sizeof(*ops3); ++i)
+  TokenKind kind;
+  char *name;
+} keywords[] = {
+    {TK_KW_RETURN, "return"},
+    {TK_KW_IF, "if"},
+    {TK_KW_ELSE, "else"},
+    {TK_KW_WHILE, "while"},
+    {TK_KW_DO, "do"},
+    {TK_KW_FOR, "for"},
+    {TK_KW_SIZEOF, "sizeof"},
+    {TK_KW_GOTO, "goto"},
+    {TK_KW_BREAK, "break"},
+    {TK_KW_CONTINUE, "continue"},
+    {TK_KW_SWITCH, "switch"},
+    {TK_KW_CASE, "case"},
+    {TK_KW_DEFAULT, "default"},
+    {TK_KW_ALIGNOF, "_Alignof"},
+    {TK_KW_RESTRICT, "restrict"},
+    {TK_KW_VOID, "void"},
+    {TK_KW_BOOL, "_Bool"},
+    {TK_KW_CHAR, "char"},
+    {TK_KW_SHORT, "short"},
+    {TK_KW_INT, "int"},
+    {TK_KW_LONG, "long"},
+    {TK_KW_STRUCT, "struct"},
+    {TK_KW_UNION, "union"},
+    {TK_KW_TYPEDEF, "typedef"},
+    {TK_KW_ENUM, "enum"},
+    {TK_KW_STATIC, "static"},
+    {TK_KW_EXTERN, "extern"},
+    {TK_KW_ALIGNAS, "_Alignas"},
+    {TK_KW_SIGNED, "signed"},
+    {TK_KW_UNSIGNED, "unsigned"},
+    {TK_KW_CONST, "const"},
+    {TK_KW_VOLATILE, "volatile"},
+    {TK_KW_REGISTER, "register"},
+    {TK_KW_NORETURN, "_Noreturn"},
+    {TK_KW_INLINE, "inline"},
+    {TK_KW_THREAD_LOCAL, "_Thread_local"},
+    {TK_KW_THREAD_LOCAL, "__thread"},
+    {TK_KW_FLOAT, "float"},
+    {TK_KW_DOUBLE, "double"},
+};
+
+// The hash function maps each keyword to a distinct slot, so
+// a lookup compares at most one string.
+#define KW_HASH_SIZE 128
+
+static int kw_hash(char *p, int len)
+{
+  return (p[0] + p[len - 1] + len * 22) & (KW_HASH_SIZE - 1);
+}
+
+static TokenKind kw_table[KW_HASH_SIZE];
+static char *kw_names[KW_HASH_SIZE];
+
+static void init_kw_table()
+{
+  for (int i = 0; i < sizeof(keywords) / sizeof(*keywords); i++)
   {
-    if (startswith(p, ops3[i]))
-      return ops3[i];
+    char *name = keywords[i].name;
+    int h = kw_hash(name, strlen(name));
+    if (kw_table[h])
+      error("internal error: keyword hash collision: %s", name);
+    kw_table[h] = keywords[i].kind;
+    kw_names[h] = name;
   }
+}
 
-  // Two-letter punctuators
-  static char *ops2[] = {"==", "!=", "<=", ">=", "->", "+=", "-=", "*=", "/=",
-                         "%=", "++", "--", "&=", "|=", "^=", "&&", "||",
-                         "<<", ">>", "##"};
-  for (int i = 0; i < sizeof(ops2) / sizeof(*ops2); ++i)
+// Returns the kind of the keyword `tok` spells, or TK_IDENT.
+static TokenKind keyword_kind(Token *tok)
+{
+  int h = kw_hash(tok->loc, tok->len);
+  TokenKind kind = kw_table[h];
+  if (kind && !strncmp(kw_names[h], tok->loc, tok->len) && !kw_names[h][tok->len])
+    return kind;
+  return TK_IDENT;
+}
+
+void convert_keywords(Token *tok)
+{
+  if (!kw_table[kw_hash("int", 3)])
+    init_kw_table();
+
+  for (Token *t = tok; t->kind != TK_EOF; t = t->next)
   {
-    if (startswith(p, ops2[i]))
-      return ops2[i];
+    if (t->kind == TK_IDENT)
+      t->kind = keyword_kind(t);
   }
+}
 
-  return NULL;
+// If `p` starts with a punctuator, returns its ID and sets its
+// length to `len`. Otherwise returns 0.
+static int read_punct(char *p, int *len)
+{
+  *len = 1;
+  switch (*p)
+  {
+  case '(':
+  case ')':
+  case '{':
+  case '}':
+  case '[':
+  case ']':
+  case ';':
+  case ',':
+  case '~':
+  case '?':
+  case ':':
+    return *p;
+  case '.':
+    if (p[1] == '.' && p[2] == '.')
+      return *len = 3, PUNCT_ELLIPSIS;
+    return '.';
+  case '<':
+    if (p[1] == '<' && p[2] == '=')
+      return *len = 3, PUNCT_SHL_ASSIGN;
+    if (p[1] == '<')
+      return *len = 2, PUNCT_SHL;
+    if (p[1] == '=')
+      return *len = 2, PUNCT_LE;
+    return '<';
+  case '>':
+    if (p[1] == '>' && p[2] == '=')
+      return *len = 3, PUNCT_SHR_ASSIGN;
+    if (p[1] == '>')
+      return *len = 2, PUNCT_SHR;
+    if (p[1] == '=')
+      return *len = 2, PUNCT_GE;
+    return '>';
+  case '=':
+    if (p[1] == '=')
+      return *len = 2, PUNCT_EQ;
+    return '=';
+  case '!':
+    if (p[1] == '=')
+      return *len = 2, PUNCT_NE;
+    return '!';
+  case '+':
+    if (p[1] == '+')
+      return *len = 2, PUNCT_INC;
+    if (p[1] == '=')
+      return *len = 2, PUNCT_ADD_ASSIGN;
+    return '+';
+  case '-':
+    if (p[1] == '-')
+      return *len = 2, PUNCT_DEC;
+    if (p[1] == '=')
+      return *len = 2, PUNCT_SUB_ASSIGN;
+    if (p[1] == '>')
+      return *len = 2, PUNCT_ARROW;
+    return '-';
+  case '*':
+    if (p[1] == '=')
+      return *len = 2, PUNCT_MUL_ASSIGN;
+    return '*';
+  case '/':
+    if (p[1] == '=')
+      return *len = 2, PUNCT_DIV_ASSIGN;
+    return '/';
+  case '%':
+    if (p[1] == '=')
+      return *len = 2, PUNCT_MOD_ASSIGN;
+    return '%';
+  case '&':
+    if (p[1] == '&')
+      return *len = 2, PUNCT_LOGAND;
+    if (p[1] == '=')
+      return *len = 2, PUNCT_AND_ASSIGN;
+    return '&';
+  case '|':
+    if (p[1] == '|')
+      return *len = 2, PUNCT_LOGOR;
+    if (p[1] == '=')
+      return *len = 2, PUNCT_OR_ASSIGN;
+    return '|';
+  case '^':
+    if (p[1] == '=')
+      return *len = 2, PUNCT_XOR_ASSIGN;
+    return '^';
+  case '#':
+    if (p[1] == '#')
+      return *len = 2, PUNCT_HASHHASH;
+    return '#';
+  }
+  return 0;
 }
 
 // Create new token and set it to the next of tok
 static Token *new_token(TokenKind kind, Token *cur, char *str, int len)
 {
-  Token *tok = calloc(1, sizeof(Token));
+  Token *tok = alloc_token();
   tok->kind = kind;
   tok->loc = str;
   tok->len = len;
-  tok->filename = current_filename;
-  tok->filepath = current_filepath;
-  tok->input = current_input;
+  tok->file = current_file_id;
+  tok->line_no = current_file->num_lines;
   tok->at_bol = at_bol;
   tok->has_space = has_space;
+  if (at_bol)
+    line_head = tok;
   at_bol = has_space = false;
   cur->next = tok;
   return tok;
@@ -314,12 +672,14 @@ static Token *read_string_literal(Token *cur, char *start)
   char *end = p;
 
   // Find the closing double-quote.
-  for (; *end != '"'; end++)
+  for (;;)
   {
-    if (*end == '\0')
+    end = find_quote_or_backslash(end);
+    if (*end == '"')
+      break;
+    if (*end == '\0' || end[1] == '\0')
       error_at(start, "unclosed string literal");
-    if (*end == '\\')
-      end++;
+    end += 2;
   }
 
   // Allocate a buffer that is large enough to hold the entire string.
@@ -339,15 +699,20 @@ static Token *read_string_literal(Token *cur, char *start)
     }
     else
     {
-      buf[len++] = *p++;
+      // Copy the characters up to the next escape sequence at once.
+      char *q = find_quote_or_backslash(p);
+      memcpy(buf + len, p, q - p);
+      len += q - p;
+      p = q;
     }
   }
 
   buf[len++] = '\0';
 
   Token *tok = new_token(TK_STR, cur, start, p - start + 1);
-  tok->contents = buf;
-  tok->cont_len = len; // cont_len include terminating '\0'
+  Literal *lit = new_literal(tok);
+  lit->contents = buf;
+  lit->cont_len = len; // cont_len include terminating '\0'
   return tok;
 }
 
@@ -368,127 +733,207 @@ static Token *read_char_literal(Token *cur, char *start)
   p++;
 
   Token *tok = new_token(TK_NUM, cur, start, p - start);
-  tok->val = c;
-  tok->ty = int_type;
+  Literal *lit = new_literal(tok);
+  lit->val = c;
+  lit->ty = int_type;
   return tok;
 }
 
-// Initialize line info for all tokens.
-static void add_line_numbers(Token *tok)
+// Record that a line starts at `p`.
+static void add_line(char *p)
 {
-  char *p = current_input;
-  int line_no = 1;
-
-  do
+  SourceFile *file = current_file;
+  if (file->num_lines == file->line_starts_cap)
   {
-    if (p == tok->loc)
-    {
-      tok->line_no = line_no;
-      tok = tok->next;
-    }
+    file->line_starts_cap = file->line_starts_cap ? file->line_starts_cap * 2 : 16;
+    file->line_starts = realloc(file->line_starts, sizeof(int) * file->line_starts_cap);
+  }
+  file->line_starts[file->num_lines++] = p - current_input;
+}
+
+// Record the lines starting in [p, end).
+static void add_lines(char *p, char *end)
+{
+  for (; p < end; p++)
     if (*p == '\n')
-      line_no++;
-  } while (*p++);
+      add_line(p + 1);
 }
 
-static Token *read_int_literal(Token *cur, char *start)
+/*** Numeric literals ***/
+
+// Integer suffixes. A longer suffix comes before its prefixes,
+// so the first match is the longest one.
+static struct
 {
-  char *p = start;
+  char *str;
+  int len;
+  bool l;
+  bool u;
+} int_suffixes[] = {
+  {"LLU", 3, true, true}, {"LLu", 3, true, true}, {"llU", 3, true, true},
+  {"llu", 3, true, true}, {"ULL", 3, true, true}, {"Ull", 3, true, true},
+  {"uLL", 3, true, true}, {"ull", 3, true, true},
+  {"LU", 2, true, true}, {"Lu", 2, true, true}, {"lU", 2, true, true},
+  {"lu", 2, true, true}, {"UL", 2, true, true}, {"Ul", 2, true, true},
+  {"uL", 2, true, true}, {"ul", 2, true, true},
+  {"LL", 2, true, false}, {"ll", 2, true, false},
+  {"L", 1, true, false}, {"l", 1, true, false},
+  {"U", 1, false, true}, {"u", 1, false, true},
+};
+
+// Powers of ten that are exact in a double
+static double exact_pow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static int digit_value(char c)
+{
+  if (is_digit(c))
+    return c - '0';
+  if (is_hex(c))
+    return from_hex(c);
+  return 16;
+}
 
-  int base = 10;
-  if (!strncasecmp(p, "0x", 2) && is_alnum(p[2]))
-  {
-    p += 2;
-    base = 16;
-  }
-  else if (!strncasecmp(p, "0b", 2) && is_alnum(p[2]))
+static Type *int_literal_type(unsigned long val, int base, bool l, bool u)
+{
+  if (base == 10)
   {
-    p += 2;
-    base = 2;
+    if (l && u)
+      return ulong_type;
+    if (l)
+      return long_type;
+    if (u)
+      return (val >> 32) ? ulong_type : uint_type;
+    if (val >> 63)
+      return ulong_type;
+    return (val >> 31) ? long_type : int_type;
   }
-  else if (*p == '0')
+
+  if (l && u)
+    return ulong_type;
+  if (l)
+    return (val >> 63) ? ulong_type : long_type;
+  if (u)
+    return (val >> 32) ? ulong_type : uint_type;
+  if (val >> 63)
+    return ulong_type;
+  if (val >> 32)
+    return long_type;
+  if (val >> 31)
+    return uint_type;
+  return int_type;
+}
+
+// `p` points to the digits after the prefix such as "0x".
+static Token *read_int_literal(Token *cur, char *start, char *p, int base)
+{
+  // A value that does not fit is saturated as strtoul() does.
+  unsigned long max = -1;
+  unsigned long val = 0;
+  bool overflow = false;
+  for (int d; (d = digit_value(*p)) < base; p++)
   {
-    base = 8;
+    if (val > (max - d) / base)
+      overflow = true;
+    val = val * base + d;
   }
+  if (overflow)
+    val = max;
 
-  long val = strtoul(p, &p, base);
-
-  // Read U, L or LL suffixes.
   bool l = false;
   bool u = false;
-
-  if (startswith(p, "LLU") || startswith(p, "LLu") ||
-      startswith(p, "llU") || startswith(p, "llu") ||
-      startswith(p, "ULL") || startswith(p, "Ull") ||
-      startswith(p, "uLL") || startswith(p, "ull"))
+  if (is_alpha(*p))
   {
-    p += 3;
-    l = u = true;    
-  }
-  else if (!strncasecmp(p, "lu", 2) || !strncasecmp(p, "ul", 2))
-  {
-    p += 2;
-    l = u = true;
-  }
-  else if (startswith(p, "LL") || startswith(p, "ll"))
-  {
-    p += 2;
-    l = true;
-  }
-  else if (*p == 'L' || *p == 'l')
-  {
-    p++;
-    l = true;
+    for (int i = 0; i < sizeof(int_suffixes) / sizeof(*int_suffixes); i++)
+    {
+      if (!strncmp(p, int_suffixes[i].str, int_suffixes[i].len))
+      {
+        p += int_suffixes[i].len;
+        l = int_suffixes[i].l;
+        u = int_suffixes[i].u;
+        break;
+      }
+    }
   }
-  else if (*p == 'U' || *p == 'u')
+
+  Token *tok = new_token(TK_NUM, cur, start, p - start);
+  Literal *lit = new_literal(tok);
+  lit->val = val;
+  lit->ty = int_literal_type(val, base, l, u);
+  return tok;
+}
+
+// Returns the value of a decimal floating point number at `start`
+// and sets `*end` to the end of it. If the number has at most 19
+// significant digits whose value is at most 2^53, and its exponent is
+// at most 22 in magnitude, the result of a single multiplication or
+// division by an exact power of ten is correctly rounded. Only the
+// other numbers go to strtod().
+static double read_decimal(char *start, char **end)
+{
+  char *p = start;
+  unsigned long mant = 0;
+  int ndigits = 0;
+  int exp = 0;
+
+  for (; is_digit(*p); p++)
   {
-    p++;
-    u = true;
+    if (mant || *p != '0')
+    {
+      mant = mant * 10 + (*p - '0');
+      ndigits++;
+    }
+    if (ndigits > 19)
+      return strtod(start, end);
   }
 
-  // Add type
-  Type *ty;
-  if (base == 10)
+  if (*p == '.')
   {
-    if (l && u)
-      ty = ulong_type;
-    else if (l)
-      ty = long_type;
-    else if (u)
-      ty = (val >> 32) ? ulong_type : uint_type;
-    else if (val >> 63)
-      ty = ulong_type;
-    else
-      ty = (val >> 31) ? long_type : int_type;
+    for (p++; is_digit(*p); p++)
+    {
+      if (mant || *p != '0')
+      {
+        mant = mant * 10 + (*p - '0');
+        ndigits++;
+      }
+      exp--;
+      if (ndigits > 19)
+        return strtod(start, end);
+    }
   }
-  else
+
+  if (*p == 'e' || *p == 'E')
   {
-    if (l && u)
-      ty = ulong_type;
-    else if (l)
-      ty = (val >> 63) ? ulong_type : long_type;
-    else if (u)
-      ty = (val >> 32) ? ulong_type : uint_type;
-    else if (val >> 63)
-      ty = ulong_type;
-    else if (val >> 32)
-      ty = long_type;
-    else if (val >> 31)
-      ty = uint_type;
-    else
-      ty = int_type;
+    char *q = p + 1;
+    bool neg = (*q == '-');
+    if (*q == '+' || *q == '-')
+      q++;
+    if (is_digit(*q))
+    {
+      int e = 0;
+      for (; is_digit(*q); q++)
+        if (e < 10000)
+          e = e * 10 + (*q - '0');
+      exp += neg ? -e : e;
+      p = q;
+    }
   }
 
-  Token *tok = new_token(TK_NUM, cur, start, p - start);
-  tok->val = val;
-  tok->ty = ty;
-  return tok;
+  if (mant > (1UL << 53) || exp < -22 || exp > 22)
+    return strtod(start, end);
+
+  *end = p;
+  if (exp < 0)
+    return mant / exact_pow10[-exp];
+  return mant * exact_pow10[exp];
 }
 
-static Token *read_flnum_literal(Token *cur, char *start)
+static Token *read_flnum_literal(Token *cur, char *start, bool is_hex)
 {
   char *end;
-  double val = strtod(start, &end);
+  double val = is_hex ? strtod(start, &end) : read_decimal(start, &end);
 
   Type *ty;
   if (*end == 'f' || *end == 'F')
@@ -507,54 +952,113 @@ static Token *read_flnum_literal(Token *cur, char *start)
   }
 
   Token *tok = new_token(TK_NUM, cur, start, end - start);
-  tok->fval =  val;
-  tok->ty = ty;
+  Literal *lit = new_literal(tok);
+  lit->fval = val;
+  lit->ty = ty;
   return tok;
 }
 
+// Read a numeric literal. The digits are scanned once to tell an
+// integer from a floating point number, which is then parsed directly.
 static Token *read_number(Token *cur, char *start)
 {
-  // Try to parse as an integer constants.
-  Token *tok = read_int_literal(cur, start);
-  if (!strchr(".eEfF", start[tok->len]))
-    return tok;
-  
-  // If it's not an integer, it must be a floating poiint constant.
-  return read_flnum_literal(cur, start);
+  char *p = start;
+  int base = 10;
+  if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X') && is_alnum(p[2]))
+  {
+    p += 2;
+    base = 16;
+  }
+  else if (p[0] == '0' && (p[1] == 'b' || p[1] == 'B') && is_alnum(p[2]))
+  {
+    p += 2;
+    base = 2;
+  }
+  else if (*p == '0')
+  {
+    base = 8;
+  }
+
+  // Octal numbers are scanned as decimal ones, because "09.5"
+  // is a floating point number.
+  char *q = p;
+  if (base == 16)
+  {
+    while (is_hex(*q))
+      q++;
+    if (*q == '.' || *q == 'p' || *q == 'P')
+      return read_flnum_literal(cur, start, true);
+  }
+  else if (base != 2)
+  {
+    while (is_digit(*q))
+      q++;
+    if (*q == '.' || *q == 'e' || *q == 'E' || *q == 'f' || *q == 'F')
+      return read_flnum_literal(cur, start, false);
+  }
+
+  return read_int_literal(cur, start, p, base);
 }
 
-// Convert input 'user_input' to token
-Token *tokenize(char *filename, int file_no, char *p)
+// Returns true if `tok` starts a line with a directive after which
+// a group of lines may be skipped.
+static bool is_cond_directive(Token *tok)
+{
+  if (!tok || tok->punct != '#' || !tok->next)
+    return false;
+  Token *name = tok->next;
+  return equal(name, "if") || equal(name, "ifdef") || equal(name, "ifndef") ||
+         equal(name, "elif") || equal(name, "else");
+}
+
+// A lazily tokenized file is read at most this many lines at a time.
+#define LINES_PER_BATCH 64
+
+// Tokenize the current input from `p`, which is at the beginning of
+// a line. If `lazy` is true, stop after a line with #if, #ifdef,
+// #ifndef, #elif or #else, or after LINES_PER_BATCH lines, and end
+// the list with a TK_LAZY token. The preprocessor pulls the rest when
+// it gets there, and it never tokenizes the lines it skips.
+static Token *lex(char *p, bool lazy)
 {
-  current_filename = basename(strdup(filename));
-  current_filepath = filename;
-  current_input = p;
   Token head;
   head.next = NULL;
   Token *cur = &head;
   int DUMMY_LEN = 1;
+  int lines = 0;
 
   at_bol = true;
   has_space = false;
+  line_head = NULL;
+
+  if (!char_class['0'])
+    init_char_class();
 
   while (*p)
   {
     // Skip line comments.
-    if (startswith(p, "//"))
+    if (p[0] == '/' && p[1] == '/')
     {
-      p += 2;
-      while (*p != '\n')
-        p++;
+      p = find_newline(p + 2);
       has_space = true;
       continue;
     }
 
     // Skip block comments.
-    if (startswith(p, "/*"))
+    if (p[0] == '/' && p[1] == '*')
     {
-      char *q = strstr(p + 2, "*/");
-      if (!q)
-        error_at(p, "unclosed block comment");
+      char *q = p + 2;
+      for (;;)
+      {
+        q = find_byte2(q, '*', '\n');
+        if (*q == '\0')
+          error_at(p, "unclosed block comment");
+        if (*q == '\n')
+          add_line(q + 1);
+        else if (q[1] == '/')
+          break;
+        q++;
+      }
       p = q + 2;
       has_space = true;
       continue;
@@ -564,13 +1068,28 @@ Token *tokenize(char *filename, int file_no, char *p)
     if (*p == '\n')
     {
       ++p;
+      add_line(p);
       at_bol = true;
       has_space = false;
+
+      if (lazy && (++lines == LINES_PER_BATCH || is_cond_directive(line_head)))
+      {
+        new_token(TK_LAZY, cur, p, 0);
+        return head.next;
+      }
+      line_head = NULL;
       continue;
     }
 
     // Spaces
-    if (isspace(*p))
+    if (*p == ' ' || *p == '\t')
+    {
+      p = skip_blanks(p + 1);
+      has_space = true;
+      continue;
+    }
+
+    if (is_space(*p))
     {
       ++p;
       has_space = true;
@@ -578,7 +1097,7 @@ Token *tokenize(char *filename, int file_no, char *p)
     }
 
     // Numeric literal
-    if (isdigit(*p) || (p[0] == '.' && isdigit(p[1])))
+    if (is_digit(*p) || (p[0] == '.' && is_digit(p[1])))
     {
       cur = read_number(cur, p);
       p += cur->len;
@@ -589,15 +1108,17 @@ Token *tokenize(char *filename, int file_no, char *p)
     if (*p == '\'')
     {
       cur = read_char_literal(cur, p);
+      add_lines(p, p + cur->len);
       p += cur->len;
       continue;
     }
 
     // Wide character literal
     // TODO: currently handled as normal character literal
-    if (startswith(p, "L'"))
+    if (p[0] == 'L' && p[1] == '\'')
     {
       cur = read_char_literal(cur, p + 1);
+      add_lines(p, p + cur->len + 1);
       p += cur->len + 1;
       continue;
     }
@@ -606,38 +1127,28 @@ Token *tokenize(char *filename, int file_no, char *p)
     if (*p == '"')
     {
       cur = read_string_literal(cur, p);
+      add_lines(p, p + cur->len);
       p += cur->len;
       continue;
     }
 
-    // Keywords or multi-letter symbols
-    char *kw = starts_with_multi_letter_symbol(p);
-    if (kw)
+    // Punctuators
+    int len;
+    int punct = read_punct(p, &len);
+    if (punct)
     {
-      int len = strlen(kw);
       cur = new_token(TK_RESERVED, cur, p, len);
+      cur->punct = punct;
       p += len;
       continue;
     }
 
-    // Single-letter symbols
-    if (*p == '+' || *p == '-' || *p == '*' || *p == '/' ||
-        *p == '(' || *p == ')' || *p == '{' || *p == '}' ||
-        *p == '<' || *p == '>' || *p == '=' || *p == ';' ||
-        *p == ',' || *p == '.' || *p == '&' || *p == '[' ||
-        *p == ']' || *p == '!' || *p == '~' || *p == '%' ||
-        *p == '|' || *p == '^' || *p == ':' || *p == '?' ||
-        *p == '#')
-    {
-      cur = new_token(TK_RESERVED, cur, p++, 1);
-      continue;
-    }
-
     // Variables
     if (is_alpha(*p))
     {
       cur = new_token(TK_IDENT, cur, p, DUMMY_LEN);
       cur->len = var_len(p);
+      cur->ident = intern(p, cur->len);
       p += cur->len;
       continue;
     }
@@ -645,29 +1156,187 @@ Token *tokenize(char *filename, int file_no, char *p)
     error_at(p, "Can not tokenize.");
   }
   new_token(TK_EOF, cur, p, DUMMY_LEN);
-  for (Token *t = head.next; t; t = t->next)
-    t->file_no = file_no;
-  add_line_numbers(head.next);
+  current_file->lexed_to_end = true;
   return head.next;
 }
 
-// Return the contents of a given file.
-static char *read_file(char *path)
+// `padded` is true if `p` is zero-filled up to a word boundary.
+static Token *tokenize_buf(char *filename, int file_no, char *p, bool padded)
 {
-  FILE *fp;
+  new_source_file(filename, file_no, p, padded);
+  current_input = p;
+  add_line(p);
+  return lex(p, false);
+}
 
-  if (strcmp(path, "-") == 0)
+// Convert input 'user_input' to token
+Token *tokenize(char *filename, int file_no, char *p)
+{
+  return tokenize_buf(filename, file_no, p, false);
+}
+
+// Start tokenizing the rest of the input `tok` refers to.
+static void resume_at(Token *tok)
+{
+  current_file = tok_file(tok);
+  current_file_id = tok->file;
+  current_input = current_file->contents;
+}
+
+// Replace a TK_LAZY token with the tokens it stands for.
+void resume_tokenize(Token *tok)
+{
+  resume_at(tok);
+  *tok = *lex(tok->loc, true);
+}
+
+// Tokenize all the rest of a lazily tokenized list.
+void tokenize_all(Token *tok)
+{
+  while (tok->kind != TK_EOF)
   {
-    // By convention, read from stdin if a given filename is "-".
-    fp = stdin;
+    if (tok->kind == TK_LAZY)
+      resume_tokenize(tok);
+    else
+      tok = tok->next;
   }
-  else
+}
+
+/*** Skipping inactive lines ***/
+
+// Returns the end of the block comment starting at `p`.
+static char *skip_block_comment(char *p)
+{
+  char *q = p + 2;
+  for (;;)
   {
-    fp = fopen(path, "r");
-    if (!fp)
-      return NULL;
+    q = find_byte2(q, '*', '\n');
+    if (*q == '\0')
+      error_at(p, "unclosed block comment");
+    if (*q == '\n')
+      add_line(q + 1);
+    else if (q[1] == '/')
+      return q + 2;
+    q++;
+  }
+}
+
+// Returns the beginning of the next line. `p` is at or after the
+// beginning of a line, but not in a comment or literal.
+static char *skip_line_bytes(char *p)
+{
+  for (;;)
+  {
+    switch (*p)
+    {
+    case '\0':
+      return p;
+    case '\n':
+      add_line(p + 1);
+      return p + 1;
+    case '"':
+    case '\'':
+    {
+      // Unterminated literals are allowed in skipped lines.
+      char quote = *p++;
+      while (*p != quote && *p != '\n' && *p)
+        p += (*p == '\\' && p[1] != '\n' && p[1]) ? 2 : 1;
+      if (*p == quote)
+        p++;
+      continue;
+    }
+    case '/':
+      if (p[1] == '/')
+        p = find_newline(p + 2);
+      else if (p[1] == '*')
+        p = skip_block_comment(p);
+      else
+        p++;
+      continue;
+    default:
+      p++;
+    }
+  }
+}
+
+// Returns true if `p` starts with the directive name `name`.
+static bool is_directive(char *p, char *name)
+{
+  int len = strlen(name);
+  return !strncmp(p, name, len) && !is_alnum(p[len]);
+}
+
+// Returns the first byte at or after `p` that is not a space, other
+// than a newline, or in a block comment.
+static char *skip_blanks_and_comments(char *p)
+{
+  for (;;)
+  {
+    p = skip_blanks(p);
+    if (p[0] == '/' && p[1] == '*')
+      p = skip_block_comment(p);
+    else if (is_space(*p) && *p != '\n')
+      p++;
+    else
+      return p;
   }
+}
 
+// Skip the lines following a TK_LAZY token `tok` up to the next #elif,
+// #else or #endif that is not in a nested group, without tokenizing
+// them. `tok` is replaced with the tokens from that directive.
+void skip_inactive(Token *tok)
+{
+  resume_at(tok);
+  current_file->skipped = true;
+
+  char *p = tok->loc;
+  int depth = 0;
+  while (*p)
+  {
+    char *line = p;
+    int num_lines = current_file->num_lines;
+
+    p = skip_blanks_and_comments(p);
+
+    if (*p == '#')
+    {
+      p = skip_blanks_and_comments(p + 1);
+      if (is_directive(p, "if") || is_directive(p, "ifdef") ||
+          is_directive(p, "ifndef"))
+        depth++;
+      else if (is_directive(p, "elif") || is_directive(p, "else"))
+      {
+        if (depth == 0)
+        {
+          // The line is tokenized from its beginning again.
+          current_file->num_lines = num_lines;
+          p = line;
+          break;
+        }
+      }
+      else if (is_directive(p, "endif"))
+      {
+        if (depth == 0)
+        {
+          current_file->num_lines = num_lines;
+          p = line;
+          break;
+        }
+        depth--;
+      }
+    }
+
+    p = skip_line_bytes(p);
+  }
+
+  *tok = *lex(p, true);
+}
+
+// Read the entire stream into a heap buffer. The buffer is zero-filled
+// after the contents up to its end, which is a word boundary.
+static char *read_stream(FILE *fp)
+{
   int buflen = 4096;
   int nread = 0;
   char *buf = malloc(buflen);
@@ -687,14 +1356,59 @@ static char *read_file(char *path)
     }
   }
 
-  if (fp != stdin)
-    fclose(fp);
-
   // Canonicalize the last line by appending "\n"
   // if it does not end with a newline.
   if (nread == 0 || buf[nread - 1] != '\n')
     buf[nread++] = '\n';
-  buf[nread] = '\0';
+  memset(buf + nread, 0, buflen - nread);
+  return buf;
+}
+
+// Map a regular file into memory. The mapping is private, so the
+// pages we write to (only when removing line splices or appending
+// the last newline) are copied, and the others are shared with
+// the page cache.
+static char *map_file(int fd, long size)
+{
+  // The rest of the last page is filled with zeros, which holds the
+  // trailing "\n\0". If there is no room, the file has to be read.
+  long pagesize = sysconf(_SC_PAGESIZE);
+  if (size % pagesize == 0 || size % pagesize == pagesize - 1)
+    return NULL;
+
+  char *buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (buf == MAP_FAILED)
+    return NULL;
+  if (buf[size - 1] != '\n')
+    buf[size] = '\n';
+  return buf;
+}
+
+// Return the contents of a given file.
+static char *read_file(char *path)
+{
+  // By convention, read from stdin if a given filename is "-".
+  if (strcmp(path, "-") == 0)
+    return read_stream(stdin);
+
+  int fd = open(path, O_RDONLY);
+  if (fd == -1)
+    return NULL;
+
+  struct stat st;
+  char *buf = NULL;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    buf = map_file(fd, st.st_size);
+
+  // Fall back to reading if the file cannot be mapped.
+  if (!buf)
+  {
+    FILE *fp = fdopen(fd, "r");
+    buf = read_stream(fp);
+    fclose(fp);
+    return buf;
+  }
+  close(fd);
   return buf;
 }
 
@@ -706,6 +1420,18 @@ char **get_input_files()
 // Remove backslashed followed by a newline.
 static void remove_backslash_newline(char *p)
 {
+  // Most files have no line splices. Don't write to the buffer
+  // before the first one so that the pages are not copied.
+  for (;;)
+  {
+    p = strchr(p, '\\');
+    if (!p)
+      return;
+    if (p[1] == '\n')
+      break;
+    p++;
+  }
+
   char * q = p;
 
   // We want to keep the number of newline characters
@@ -733,20 +1459,186 @@ static void remove_backslash_newline(char *p)
   *q = '\0';
 }
 
-Token *tokenize_file(char *path)
+/*** File cache ***/
+
+// The compile server keeps the contents and tokens of the files
+// its requests have read, and a request forked from it reuses them
+// as long as the file has not been changed. A forked request gets
+// its own copy of the cache, so the cached tokens can be used
+// (and modified by the preprocessor) once without copying them.
+//
+// Every process also keeps the files it has read, so a file included
+// again is not read again. Once a file has been tokenized to the end
+// without skipping any lines, it is known to tokenize without errors.
+// Then all of it is tokenized into a pristine list, and each later
+// #include gets a copy of it.
+
+typedef struct CachedFile CachedFile;
+struct CachedFile
 {
+  struct stat st;
+  char *contents;
+  Token *tok;       // Tokens cached by the server, used once
+  SourceFile *file; // The file last tokenized lazily from `contents`
+  Token *pristine;  // All the tokens, never handed out themselves
+};
+
+static HashMap file_cache;
+
+static bool same_file(struct stat *st1, struct stat *st2)
+{
+  return st1->st_dev == st2->st_dev && st1->st_ino == st2->st_ino &&
+         st1->st_size == st2->st_size &&
+         st1->st_mtim.tv_sec == st2->st_mtim.tv_sec &&
+         st1->st_mtim.tv_nsec == st2->st_mtim.tv_nsec;
+}
+
+// Read and tokenize `path` into the cache if it is still the file
+// described by `st`, which a request has successfully compiled.
+void cache_file(char *path, struct stat *st)
+{
+  CachedFile *cf = hashmap_get(&file_cache, path);
+  if (cf && same_file(&cf->st, st))
+    return;
+
+  struct stat st2;
+  if (stat(path, &st2) || !same_file(st, &st2))
+    return;
+
   char *p = read_file(path);
   if (!p)
-    return NULL;
-  
+    return;
   remove_backslash_newline(p);
 
+  path = strdup(path);
+  cf = calloc(1, sizeof(CachedFile));
+  cf->st = st2;
+  cf->contents = p;
+
+  // The tokens are pulled lazily as in any other file. The lines in
+  // an inactive #if group don't have to be valid tokens, and lexing
+  // them here could stop the server or a batch with an error.
+  new_source_file(path, 0, p, true);
+  current_input = p;
+  add_line(p);
+  cf->tok = lex(p, true);
+  hashmap_put(&file_cache, path, cf);
+}
+
+// Write the files read so far and their stats to `fd`, one per line,
+// in the format cache_file_list() reads.
+void write_input_files(int fd)
+{
+  for (int i = 0; input_files && input_files[i]; i++)
+  {
+    struct stat *st = &input_file_stats[i];
+    if (!st->st_ino)
+      continue;
+
+    // Write each line at once so that lines from concurrent
+    // processes don't get mixed.
+    char buf[PATHNAME_SIZE + 128];
+    int len = snprintf(buf, sizeof(buf), "%lu %lu %ld %ld %ld %s\n",
+                       (unsigned long)st->st_dev, (unsigned long)st->st_ino,
+                       (long)st->st_size, (long)st->st_mtim.tv_sec,
+                       (long)st->st_mtim.tv_nsec, input_files[i]);
+    if (len < sizeof(buf))
+      write(fd, buf, len);
+  }
+}
+
+// Cache the files listed by write_input_files(), and the results of
+// file lookups listed by write_file_lookups().
+void cache_file_list(char *list)
+{
+  for (char *p = list; *p;)
+  {
+    char *end = strchr(p, '\n');
+    if (!end)
+      break;
+    *end = '\0';
+
+    if ((*p == '+' || *p == '-') && p[1] == ' ')
+    {
+      cache_file_lookup(p + 2, *p == '+');
+      p = end + 1;
+      continue;
+    }
+
+    struct stat st = {};
+    st.st_dev = strtoul(p, &p, 10);
+    st.st_ino = strtoul(p, &p, 10);
+    st.st_size = strtol(p, &p, 10);
+    st.st_mtim.tv_sec = strtol(p, &p, 10);
+    st.st_mtim.tv_nsec = strtol(p, &p, 10);
+    if (*p == ' ')
+      cache_file(p + 1, &st);
+    p = end + 1;
+  }
+}
+
+// Copy a token list up to its EOF token.
+static Token *copy_tokens(Token *tok)
+{
+  Token head = {};
+  Token *cur = &head;
+  for (; tok; tok = tok->next)
+    cur = cur->next = copy_token(tok);
+  return head.next;
+}
+
+Token *tokenize_file(char *path)
+{
+  struct stat st = {};
+  if (strcmp(path, "-"))
+    stat(path, &st);
+
+  CachedFile *cf = st.st_ino ? hashmap_get(&file_cache, path) : NULL;
+  if (!cf || !same_file(&cf->st, &st))
+  {
+    char *p = read_file(path);
+    if (!p)
+      return NULL;
+    remove_backslash_newline(p);
+
+    cf = calloc(1, sizeof(CachedFile));
+    cf->st = st;
+    cf->contents = p;
+    if (st.st_ino)
+      hashmap_put(&file_cache, path, cf);
+  }
+
   // Save the filename for assembler .file directive.
   static int file_no;
   input_files = realloc(input_files, sizeof(char *) * (file_no + 2));
   input_files[file_no] = path;
   input_files[file_no + 1] = NULL;
+  input_file_stats = realloc(input_file_stats, sizeof(struct stat) * (file_no + 1));
+  input_file_stats[file_no] = st;
   file_no++;
 
-  return tokenize(path, file_no, p);
+  // All the tokens share the SourceFile made when they were cached.
+  if (cf->tok)
+  {
+    Token *tok = cf->tok;
+    cf->tok = NULL;
+    cf->file = tok_file(tok);
+    cf->file->file_no = file_no;
+    return tok;
+  }
+
+  if (!cf->pristine && cf->file && cf->file->lexed_to_end && !cf->file->skipped)
+    cf->pristine = tokenize_buf(path, 0, cf->contents, true);
+
+  if (cf->pristine)
+  {
+    tok_file(cf->pristine)->file_no = file_no;
+    return copy_tokens(cf->pristine);
+  }
+
+  new_source_file(path, file_no, cf->contents, true);
+  cf->file = current_file;
+  current_input = cf->contents;
+  add_line(cf->contents);
+  return lex(cf->contents, true);
 }